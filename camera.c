@@ -0,0 +1,158 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "camera.h"
+
+/* CAMERA_FRAME's time step per frame, and the rate CAMERA_CLOCK runs at */
+#define FRAME_TIME_STEP 0.1
+#define CLOCK_TIME_RATE 6.0
+
+static int read_keyframes(struct camera *camera, const char *path)
+{
+	FILE *f = fopen(path, "re");
+	size_t cap = 0;
+	char line[256];
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof line, f)) {
+		struct camera_keyframe kf;
+		float angle;
+		char *comment = strchr(line, '#');
+
+		if (comment)
+			*comment = '\0';
+
+		int ret = sscanf(line, "%lf %f %f %f %f", &kf.time_s, &kf.pose.center_x,
+			&kf.pose.center_y, &kf.pose.zoom, &angle);
+		if (ret <= 0)
+			continue;
+
+		if (ret != 5 || kf.pose.zoom <= 0.0f ||
+				(camera->len > 0 && kf.time_s <= camera->keyframes[camera->len - 1].time_s)) {
+			fprintf(stderr, "%s: invalid keyframe\n", path);
+			goto error;
+		}
+		kf.pose.angle = angle * (float)(M_PI / 180.0);
+
+		if (camera->len == cap) {
+			cap = cap ? cap * 2 : 16;
+			struct camera_keyframe *keyframes =
+				realloc(camera->keyframes, cap * sizeof *keyframes);
+			if (!keyframes) {
+				perror("realloc");
+				goto error;
+			}
+			camera->keyframes = keyframes;
+		}
+
+		camera->keyframes[camera->len++] = kf;
+	}
+
+	if (camera->len == 0) {
+		fprintf(stderr, "%s: no keyframes\n", path);
+		goto error;
+	}
+
+	fclose(f);
+	return 0;
+
+error:
+	fclose(f);
+	camera_finish(camera);
+	return -1;
+}
+
+int camera_parse(struct camera *camera, const char *arg)
+{
+	camera_finish(camera);
+
+	if (strcmp(arg, "frame") == 0)
+		camera->mode = CAMERA_FRAME;
+	else if (strcmp(arg, "clock") == 0)
+		camera->mode = CAMERA_CLOCK;
+	else if (strcmp(arg, "fixed") == 0)
+		camera->mode = CAMERA_FIXED;
+	else {
+		camera->mode = CAMERA_KEYFRAMES;
+		return read_keyframes(camera, arg);
+	}
+
+	return 0;
+}
+
+void camera_finish(struct camera *camera)
+{
+	free(camera->keyframes);
+	*camera = (struct camera){0};
+}
+
+/* The zoom and rotation frag_src used to work out from frame_num */
+static void animate(double time, struct camera_pose *pose)
+{
+	double zoo = 0.62 + 0.38 * cos(0.07 * time);
+
+	pose->center_x = -0.745f;
+	pose->center_y = 0.186f;
+	pose->zoom = pow(zoo, 8.0);
+	pose->angle = 0.15 * (1.0 - zoo) * time;
+}
+
+/* Zoom is interpolated exponentially, so zooming in looks steady */
+static void interpolate(const struct camera *camera, double time_s, struct camera_pose *pose)
+{
+	const struct camera_keyframe *kf = camera->keyframes;
+	double period = kf[camera->len - 1].time_s;
+	size_t i = 1;
+
+	if (camera->len == 1 || period <= 0.0) {
+		*pose = kf[camera->len - 1].pose;
+		return;
+	}
+
+	time_s = fmod(time_s, period);
+	if (time_s < kf[0].time_s) {
+		*pose = kf[0].pose;
+		return;
+	}
+	while (kf[i].time_s < time_s)
+		++i;
+
+	const struct camera_pose *a = &kf[i - 1].pose;
+	const struct camera_pose *b = &kf[i].pose;
+	float t = (time_s - kf[i - 1].time_s) / (kf[i].time_s - kf[i - 1].time_s);
+
+	pose->center_x = a->center_x + (b->center_x - a->center_x) * t;
+	pose->center_y = a->center_y + (b->center_y - a->center_y) * t;
+	pose->zoom = a->zoom * powf(b->zoom / a->zoom, t);
+	pose->angle = a->angle + (b->angle - a->angle) * t;
+}
+
+void camera_pose(struct camera *camera, int frame_num, uint64_t now_ns,
+		struct camera_pose *pose)
+{
+	if (!camera->start_ns)
+		camera->start_ns = now_ns;
+
+	double time_s = (double)(now_ns - camera->start_ns) * 1e-9;
+
+	switch (camera->mode) {
+	case CAMERA_FRAME:
+		animate(frame_num * FRAME_TIME_STEP, pose);
+		break;
+	case CAMERA_CLOCK:
+		animate(time_s * CLOCK_TIME_RATE, pose);
+		break;
+	case CAMERA_FIXED:
+		animate(0.0, pose);
+		break;
+	case CAMERA_KEYFRAMES:
+		interpolate(camera, time_s, pose);
+		break;
+	}
+}
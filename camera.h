@@ -0,0 +1,59 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum camera_mode {
+	/* The original animation, advanced by a fixed step every frame */
+	CAMERA_FRAME,
+	/* The same animation, advanced by wall-clock time */
+	CAMERA_CLOCK,
+	/* Never moves, so every frame costs the same */
+	CAMERA_FIXED,
+	/* Interpolated from a keyframe file, by wall-clock time */
+	CAMERA_KEYFRAMES,
+};
+
+/* What the fragment shader and cpu_render() take as uniforms */
+struct camera_pose {
+	float center_x;
+	float center_y;
+	/* Size of a unit of screen height in the complex plane */
+	float zoom;
+	/* In radians, counter-clockwise */
+	float angle;
+};
+
+struct camera_keyframe {
+	double time_s;
+	struct camera_pose pose;
+};
+
+/*
+ * With CAMERA_FRAME, the workload of a frame depends on how many frames
+ * were drawn before it. The other modes don't, so runs are comparable
+ * whatever the frame rate was.
+ */
+struct camera {
+	enum camera_mode mode;
+	struct camera_keyframe *keyframes;
+	size_t len;
+	/* When the first pose was asked for */
+	uint64_t start_ns;
+};
+
+/*
+ * arg is frame, clock or fixed, or else the path of a keyframe file. It
+ * has one keyframe per line, as time in seconds, center x and y, zoom and
+ * angle in degrees, with times going up. The path repeats after the last
+ * one.
+ */
+int camera_parse(struct camera *camera, const char *arg);
+
+void camera_finish(struct camera *camera);
+
+void camera_pose(struct camera *camera, int frame_num, uint64_t now_ns,
+	struct camera_pose *pose);
+
+#endif
@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clients.h"
+#include "stats.h"
+#include "util.h"
+
+struct client_stats {
+	uint64_t frames;
+	uint64_t presented;
+	uint64_t discarded;
+};
+
+static volatile sig_atomic_t quit_requested;
+static volatile sig_atomic_t summary_requested;
+
+static void handle_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		summary_requested = 1;
+	else
+		quit_requested = 1;
+}
+
+int clients_fork(struct clients *clients, int num, double stagger_ms)
+{
+	int fds[2];
+
+	*clients = (struct clients){ .num = num, .fd = -1, .index = -1 };
+
+	clients->pids = calloc(num, sizeof *clients->pids);
+	if (!clients->pids) {
+		perror("calloc");
+		return -1;
+	}
+
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		perror("pipe2");
+		free(clients->pids);
+		return -1;
+	}
+
+	/* Don't let everything buffered so far get printed once per worker */
+	fflush(stdout);
+
+	for (int i = 0; i < num; ++i) {
+		pid_t pid = fork();
+		if (pid == -1) {
+			perror("fork");
+			/* Carry on with the ones we have */
+			clients->num = i;
+			break;
+		}
+
+		if (pid == 0) {
+			uint64_t delay_ns = i * stagger_ms * 1e6;
+			struct timespec ts = {
+				.tv_sec = delay_ns / 1000000000,
+				.tv_nsec = delay_ns % 1000000000,
+			};
+
+			close(fds[0]);
+			free(clients->pids);
+			*clients = (struct clients){ .num = num, .fd = fds[1], .index = i };
+
+			nanosleep(&ts, NULL);
+			return 0;
+		}
+
+		clients->pids[i] = pid;
+	}
+
+	close(fds[1]);
+	clients->fd = fds[0];
+
+	return clients->num > 0 ? 0 : -1;
+}
+
+static void print_summary(const struct stats *stats, const struct client_stats *per_client,
+		int num, int running)
+{
+	stats_print(stats, "Clients", get_time_ns(), stdout);
+	if (running)
+		printf("Clients: %d of %d running\n", running, num);
+
+	for (int i = 0; i < num; ++i) {
+		printf("Client %d: %" PRIu64 " frames, %" PRIu64 " presented, %" PRIu64 " discarded\n",
+			i, per_client[i].frames, per_client[i].presented, per_client[i].discarded);
+	}
+
+	fflush(stdout);
+}
+
+/*
+ * Reaps workers which have exited, or waits for all of them with block.
+ * Reaped ones have their pid set to -1. Returns how many are still running.
+ */
+static int reap(struct clients *clients, bool block, int *failed)
+{
+	int running = 0;
+
+	for (int i = 0; i < clients->num; ++i) {
+		int status = 0;
+		pid_t ret;
+
+		if (clients->pids[i] == -1)
+			continue;
+
+		while ((ret = waitpid(clients->pids[i], &status, block ? 0 : WNOHANG)) == -1 &&
+				errno == EINTR)
+			;
+
+		if (ret == 0) {
+			++running;
+			continue;
+		}
+
+		if (ret == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			++*failed;
+		clients->pids[i] = -1;
+	}
+
+	return running;
+}
+
+int clients_aggregate(struct clients *clients)
+{
+	static struct stats stats;
+	struct client_stats *per_client = calloc(clients->num, sizeof *per_client);
+	struct client_record records[128];
+	size_t len = 0;
+	int running = clients->num;
+	int failed = 0;
+
+	if (!per_client) {
+		perror("calloc");
+		return 1;
+	}
+
+	stats_init(&stats);
+	stats.start_ns = get_time_ns();
+
+	{
+		struct sigaction sa = { .sa_handler = handle_signal };
+		sigemptyset(&sa.sa_mask);
+
+		/* No SA_RESTART, so that read returns */
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGUSR1, &sa, NULL);
+	}
+
+	for (;;) {
+		ssize_t ret = read(clients->fd, (char *)records + len, sizeof records - len);
+
+		if (quit_requested) {
+			quit_requested = 0;
+			for (int i = 0; i < clients->num; ++i) {
+				if (clients->pids[i] != -1)
+					kill(clients->pids[i], SIGTERM);
+			}
+		}
+
+		if (summary_requested) {
+			summary_requested = 0;
+			running = reap(clients, false, &failed);
+			print_summary(&stats, per_client, clients->num, running);
+		}
+
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1) {
+			perror("read");
+			break;
+		}
+		/* Every worker has closed its end */
+		if (ret == 0)
+			break;
+
+		len += ret;
+
+		size_t n = len / sizeof *records;
+		for (size_t i = 0; i < n; ++i) {
+			const struct client_record *r = &records[i];
+			if (r->client >= clients->num)
+				continue;
+
+			struct client_stats *c = &per_client[r->client];
+			++c->frames;
+			if (r->frame_ns)
+				stats_record_frame(&stats, r->frame_ns);
+			if (r->flags & CLIENT_RECORD_PRESENTED) {
+				++c->presented;
+				stats_record_present(&stats, r->present_ns);
+			}
+			if (r->flags & CLIENT_RECORD_DISCARDED) {
+				++c->discarded;
+				++stats.discarded;
+			}
+		}
+
+		/* Writes are atomic, but be careful anyway */
+		len -= n * sizeof *records;
+		memmove(records, (char *)records + n * sizeof *records, len);
+	}
+
+	running = reap(clients, true, &failed);
+
+	print_summary(&stats, per_client, clients->num, running);
+	if (failed)
+		printf("Clients: %d exited with an error\n", failed);
+
+	close(clients->fd);
+	free(clients->pids);
+	free(per_client);
+
+	return failed ? 1 : 0;
+}
+
+void clients_report(const struct clients *clients, const struct frame *frame)
+{
+	struct client_record r = {
+		.client = clients->index,
+		.surface = frame->surface,
+		.frame_num = frame->frame_num,
+	};
+
+	if (frame->end_ns)
+		r.frame_ns = frame->end_ns - frame->start_ns;
+	else
+		r.frame_ns = frame->gpu_time_ns;
+
+	if (frame->presented_ns) {
+		r.flags |= CLIENT_RECORD_PRESENTED;
+		r.present_ns = frame->presented_ns - frame->start_ns;
+	} else if (frame->discarded) {
+		r.flags |= CLIENT_RECORD_DISCARDED;
+	}
+
+	if (write(clients->fd, &r, sizeof r) == -1)
+		perror("write");
+}
@@ -0,0 +1,53 @@
+#ifndef CLIENTS_H
+#define CLIENTS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "frames.h"
+
+#define CLIENT_RECORD_PRESENTED (1 << 0)
+#define CLIENT_RECORD_DISCARDED (1 << 1)
+
+/*
+ * Sent by a worker for every retired frame. Much smaller than PIPE_BUF, so
+ * every worker can share one pipe without records getting interleaved.
+ */
+struct client_record {
+	uint16_t client;
+	uint16_t surface;
+	uint32_t frame_num;
+	/* Submission to render completion, or GPU time, 0 when unknown */
+	uint64_t frame_ns;
+	/* Submission to presentation */
+	uint64_t present_ns;
+	uint32_t flags;
+};
+
+/*
+ * --clients runs the whole program in that many worker processes, each
+ * with its own connection, while the parent only aggregates their records.
+ */
+struct clients {
+	int num;
+	pid_t *pids;
+	/* The pipe's read end in the parent, its write end in a worker */
+	int fd;
+	/* This worker's index, or -1 in the parent */
+	int index;
+};
+
+/*
+ * Forks num workers, the ith of which waits i * stagger_ms before starting
+ * so that the load ramps up. Returns -1 on error, and 0 in both the parent
+ * and the workers otherwise.
+ */
+int clients_fork(struct clients *clients, int num, double stagger_ms);
+
+/* Reads records until every worker has exited, and returns the exit status */
+int clients_aggregate(struct clients *clients);
+
+/* Called by a worker as each frame retires */
+void clients_report(const struct clients *clients, const struct frame *frame);
+
+#endif
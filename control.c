@@ -0,0 +1,40 @@
+#include <math.h>
+
+#include "control.h"
+
+/*
+ * Measurements lag behind by however many frames are in flight, so keep
+ * the gains low enough that a few frames of delay don't cause oscillation.
+ */
+#define KP 0.3
+#define KI 0.2
+
+void iter_control_init(struct iter_control *ctl, double target_ms, int iter)
+{
+	ctl->target_ms = target_ms;
+	ctl->base = log(iter > 0 ? iter : 1);
+	ctl->integral = 0.0;
+	ctl->min_iter = 1;
+	ctl->max_iter = 1 << 20;
+}
+
+int iter_control_update(struct iter_control *ctl, double frame_ms)
+{
+	if (frame_ms <= 0.0)
+		return (int)lround(exp(ctl->base + KI * ctl->integral));
+
+	double err = log(ctl->target_ms / frame_ms);
+	double integral = ctl->integral + err;
+	double u = ctl->base + KP * err + KI * integral;
+	double iter = exp(u);
+
+	/* Stop integrating while saturated, or it takes forever to recover */
+	if (iter < ctl->min_iter)
+		iter = ctl->min_iter;
+	else if (iter > ctl->max_iter)
+		iter = ctl->max_iter;
+	else
+		ctl->integral = integral;
+
+	return (int)lround(iter);
+}
@@ -0,0 +1,22 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+/*
+ * PI controller which retunes the iteration count so that frames take
+ * target_ms. It works on log(iter), as frame time is roughly proportional
+ * to iter, which keeps the loop gain the same at any zoom level.
+ */
+struct iter_control {
+	double target_ms;
+	double base;
+	double integral;
+	int min_iter;
+	int max_iter;
+};
+
+void iter_control_init(struct iter_control *ctl, double target_ms, int iter);
+
+/* Feeds in a measured frame time, returns the iteration count to use next */
+int iter_control_update(struct iter_control *ctl, double frame_ms);
+
+#endif
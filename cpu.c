@@ -0,0 +1,272 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#include "cpu.h"
+
+/*
+ * This is a straight port of frag_src. Only the escape loop is vectorised;
+ * the colouring afterwards runs once per subsample and isn't worth it.
+ *
+ * Each kernel computes LANES horizontally adjacent pixels for a single
+ * subsample, writing out the iteration count and the final |z|^2.
+ */
+#define MAX_LANES 16
+#define B2 (256.0f * 256.0f)
+
+typedef void (*kernel_fn)(const struct cpu_frame *frame,
+	const struct cpu_sample *s, float frag_x, float frag_y,
+	float *l, float *mag);
+
+static void kernel_scalar(const struct cpu_frame *frame,
+		const struct cpu_sample *s, float frag_x, float frag_y,
+		float *l_out, float *mag_out)
+{
+	const float w = frame->width;
+	const float h = frame->height;
+	const float py = (-h + 2.0f * (frag_y + s->off_y)) / h;
+
+	for (int lane = 0; lane < 8; ++lane) {
+		float px = (-w + 2.0f * (frag_x + lane + s->off_x)) / h;
+		float cx = frame->center_x + (px * s->coa - py * s->sia) * s->zoo;
+		float cy = frame->center_y + (px * s->sia + py * s->coa) * s->zoo;
+		float zx = 0.0f;
+		float zy = 0.0f;
+		float l = 0.0f;
+
+		for (int i = 0; i < frame->iter; ++i) {
+			float t = zx * zx - zy * zy + cx;
+			zy = 2.0f * zx * zy + cy;
+			zx = t;
+			if (zx * zx + zy * zy > B2)
+				break;
+			l += 1.0f;
+		}
+
+		l_out[lane] = l;
+		mag_out[lane] = zx * zx + zy * zy;
+	}
+}
+
+#ifdef HAVE_X86
+__attribute__((target("avx2,fma")))
+static void kernel_avx2(const struct cpu_frame *frame,
+		const struct cpu_sample *s, float frag_x, float frag_y,
+		float *l_out, float *mag_out)
+{
+	const float w = frame->width;
+	const float h = frame->height;
+	const float py = (-h + 2.0f * (frag_y + s->off_y)) / h;
+
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 b2 = _mm256_set1_ps(B2);
+	const __m256 lane = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+
+	__m256 fx = _mm256_add_ps(_mm256_set1_ps(frag_x), lane);
+	fx = _mm256_add_ps(fx, _mm256_set1_ps(s->off_x));
+	__m256 px = _mm256_mul_ps(two, fx);
+	px = _mm256_sub_ps(px, _mm256_set1_ps(w));
+	px = _mm256_div_ps(px, _mm256_set1_ps(h));
+
+	__m256 cx = _mm256_sub_ps(_mm256_mul_ps(px, _mm256_set1_ps(s->coa)),
+		_mm256_set1_ps(py * s->sia));
+	cx = _mm256_add_ps(_mm256_set1_ps(frame->center_x),
+		_mm256_mul_ps(cx, _mm256_set1_ps(s->zoo)));
+	__m256 cy = _mm256_add_ps(_mm256_mul_ps(px, _mm256_set1_ps(s->sia)),
+		_mm256_set1_ps(py * s->coa));
+	cy = _mm256_add_ps(_mm256_set1_ps(frame->center_y),
+		_mm256_mul_ps(cy, _mm256_set1_ps(s->zoo)));
+
+	__m256 zx = _mm256_setzero_ps();
+	__m256 zy = _mm256_setzero_ps();
+	__m256 l = _mm256_setzero_ps();
+	__m256 mag = _mm256_setzero_ps();
+	__m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+	for (int i = 0; i < frame->iter; ++i) {
+		__m256 nx = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(zx, zx),
+			_mm256_mul_ps(zy, zy)), cx);
+		__m256 ny = _mm256_add_ps(_mm256_mul_ps(two,
+			_mm256_mul_ps(zx, zy)), cy);
+
+		/* Escaped lanes keep the z they escaped with */
+		zx = _mm256_blendv_ps(zx, nx, active);
+		zy = _mm256_blendv_ps(zy, ny, active);
+		mag = _mm256_add_ps(_mm256_mul_ps(zx, zx), _mm256_mul_ps(zy, zy));
+
+		active = _mm256_and_ps(active, _mm256_cmp_ps(mag, b2, _CMP_LE_OQ));
+		if (_mm256_movemask_ps(active) == 0)
+			break;
+		l = _mm256_add_ps(l, _mm256_and_ps(active, one));
+	}
+
+	_mm256_storeu_ps(l_out, l);
+	_mm256_storeu_ps(mag_out, mag);
+}
+
+__attribute__((target("avx512f")))
+static void kernel_avx512(const struct cpu_frame *frame,
+		const struct cpu_sample *s, float frag_x, float frag_y,
+		float *l_out, float *mag_out)
+{
+	const float w = frame->width;
+	const float h = frame->height;
+	const float py = (-h + 2.0f * (frag_y + s->off_y)) / h;
+
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 two = _mm512_set1_ps(2.0f);
+	const __m512 b2 = _mm512_set1_ps(B2);
+	const __m512 lane = _mm512_set_ps(15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0);
+
+	__m512 fx = _mm512_add_ps(_mm512_set1_ps(frag_x), lane);
+	fx = _mm512_add_ps(fx, _mm512_set1_ps(s->off_x));
+	__m512 px = _mm512_mul_ps(two, fx);
+	px = _mm512_sub_ps(px, _mm512_set1_ps(w));
+	px = _mm512_div_ps(px, _mm512_set1_ps(h));
+
+	__m512 cx = _mm512_sub_ps(_mm512_mul_ps(px, _mm512_set1_ps(s->coa)),
+		_mm512_set1_ps(py * s->sia));
+	cx = _mm512_add_ps(_mm512_set1_ps(frame->center_x),
+		_mm512_mul_ps(cx, _mm512_set1_ps(s->zoo)));
+	__m512 cy = _mm512_add_ps(_mm512_mul_ps(px, _mm512_set1_ps(s->sia)),
+		_mm512_set1_ps(py * s->coa));
+	cy = _mm512_add_ps(_mm512_set1_ps(frame->center_y),
+		_mm512_mul_ps(cy, _mm512_set1_ps(s->zoo)));
+
+	__m512 zx = _mm512_setzero_ps();
+	__m512 zy = _mm512_setzero_ps();
+	__m512 l = _mm512_setzero_ps();
+	__m512 mag = _mm512_setzero_ps();
+	__mmask16 active = 0xffff;
+
+	for (int i = 0; i < frame->iter; ++i) {
+		__m512 nx = _mm512_add_ps(_mm512_sub_ps(_mm512_mul_ps(zx, zx),
+			_mm512_mul_ps(zy, zy)), cx);
+		__m512 ny = _mm512_add_ps(_mm512_mul_ps(two,
+			_mm512_mul_ps(zx, zy)), cy);
+
+		zx = _mm512_mask_mov_ps(zx, active, nx);
+		zy = _mm512_mask_mov_ps(zy, active, ny);
+		mag = _mm512_add_ps(_mm512_mul_ps(zx, zx), _mm512_mul_ps(zy, zy));
+
+		active = _mm512_mask_cmp_ps_mask(active, mag, b2, _CMP_LE_OQ);
+		if (!active)
+			break;
+		l = _mm512_mask_add_ps(l, active, l, one);
+	}
+
+	_mm512_storeu_ps(l_out, l);
+	_mm512_storeu_ps(mag_out, mag);
+}
+#endif
+
+static kernel_fn kernel = kernel_scalar;
+static int kernel_lanes = 8;
+
+const char *cpu_init(void)
+{
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f")) {
+		kernel = kernel_avx512;
+		kernel_lanes = 16;
+		return "avx512";
+	}
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		kernel = kernel_avx2;
+		kernel_lanes = 8;
+		return "avx2";
+	}
+#endif
+
+	kernel = kernel_scalar;
+	kernel_lanes = 8;
+	return "scalar";
+}
+
+void cpu_frame_init(struct cpu_frame *frame, const struct camera_pose *pose,
+		int width, int height, int iter, int aa)
+{
+	frame->width = width;
+	frame->height = height;
+	frame->iter = iter;
+	frame->aa = aa;
+	frame->center_x = pose->center_x;
+	frame->center_y = pose->center_y;
+
+	for (int m = 0; m < aa; ++m)
+	for (int n = 0; n < aa; ++n) {
+		struct cpu_sample *s = &frame->samples[aa * m + n];
+
+		s->off_x = (float)m / (float)aa;
+		s->off_y = (float)n / (float)aa;
+		s->coa = cosf(pose->angle);
+		s->sia = sinf(pose->angle);
+		s->zoo = pose->zoom;
+	}
+}
+
+static float smoothstep(float edge0, float edge1, float x)
+{
+	float t = fminf(fmaxf((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+	return t * t * (3.0f - 2.0f * t);
+}
+
+/* NaN (points inside the set) ends up black, as it does on most GPUs */
+static uint32_t to_unorm8(float c)
+{
+	return (uint32_t)(fminf(fmaxf(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+void cpu_render(const struct cpu_frame *frame, uint32_t *data, int stride,
+		int x0, int y0, int x1, int y1)
+{
+	const int samples = frame->aa * frame->aa;
+	const float al = smoothstep(-0.1f, 0.0f, sinf(0.5f * 6.2831f));
+
+	for (int y = y0; y < y1; ++y) {
+		uint32_t *row = data + (size_t)y * stride;
+		/* gl_FragCoord has its origin at the bottom left */
+		float frag_y = (float)(frame->height - y) - 0.5f;
+
+		for (int x = x0; x < x1; x += kernel_lanes) {
+			float r[MAX_LANES] = {0};
+			float g[MAX_LANES] = {0};
+			float b[MAX_LANES] = {0};
+			int n = x1 - x < kernel_lanes ? x1 - x : kernel_lanes;
+
+			for (int i = 0; i < samples; ++i) {
+				float l[MAX_LANES];
+				float mag[MAX_LANES];
+
+				kernel(frame, &frame->samples[i], (float)x + 0.5f,
+					frag_y, l, mag);
+
+				for (int k = 0; k < n; ++k) {
+					float sl = l[k] - log2f(log2f(mag[k])) + 4.0f;
+					float v = 3.0f + (l[k] * (1.0f - al) + sl * al) * 0.15f;
+
+					r[k] += 0.5f + 0.5f * cosf(v);
+					g[k] += 0.5f + 0.5f * cosf(v + 0.6f);
+					b[k] += 0.5f + 0.5f * cosf(v + 1.0f);
+				}
+			}
+
+			for (int k = 0; k < n; ++k) {
+				row[x + k] = 0xff000000 |
+					to_unorm8(r[k] / samples) << 16 |
+					to_unorm8(g[k] / samples) << 8 |
+					to_unorm8(b[k] / samples);
+			}
+		}
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+#include "camera.h"
+
+/* Largest -a accepted by the CPU renderer */
+#define CPU_MAX_AA 16
+
+/* Per-subsample constants, identical for every pixel in a frame */
+struct cpu_sample {
+	float off_x;
+	float off_y;
+	float zoo;
+	float coa;
+	float sia;
+};
+
+struct cpu_frame {
+	int width;
+	int height;
+	int iter;
+	int aa;
+	float center_x;
+	float center_y;
+	struct cpu_sample samples[CPU_MAX_AA * CPU_MAX_AA];
+};
+
+/*
+ * Picks the widest kernel supported by this CPU and returns its name.
+ * Must be called before cpu_render().
+ */
+const char *cpu_init(void);
+
+/* Evaluates everything in frag_src which is the same for every pixel */
+void cpu_frame_init(struct cpu_frame *frame, const struct camera_pose *pose,
+	int width, int height, int iter, int aa);
+
+/*
+ * Renders the rectangle [x0, x1) x [y0, y1) as XRGB8888 into data, which
+ * points at pixel (0, 0) of a buffer with the given stride in pixels.
+ * Row 0 is the top of the buffer.
+ */
+void cpu_render(const struct cpu_frame *frame, uint32_t *data, int stride,
+	int x0, int y0, int x1, int y1);
+
+#endif
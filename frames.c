@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "frames.h"
+
+int frame_set_init(struct frame_set *set, int epoll_fd, size_t cap)
+{
+	*set = (struct frame_set){0};
+
+	set->slots = calloc(cap, sizeof *set->slots);
+	set->free = calloc(cap, sizeof *set->free);
+
+	if (!set->slots || !set->free) {
+		frame_set_finish(set);
+		return -1;
+	}
+
+	/* Hand out low slots first, they're more likely to be in cache */
+	for (size_t i = 0; i < cap; ++i) {
+		set->free[i] = cap - 1 - i;
+		set->slots[i].fd = -1;
+	}
+
+	set->epoll_fd = epoll_fd;
+	set->free_len = cap;
+	set->cap = cap;
+	set->completed_tail = &set->completed;
+
+	return 0;
+}
+
+void frame_set_finish(struct frame_set *set)
+{
+	for (size_t i = 0; i < set->cap; ++i) {
+		if (set->slots[i].fd >= 0)
+			close(set->slots[i].fd);
+	}
+
+	free(set->slots);
+	free(set->free);
+	*set = (struct frame_set){0};
+}
+
+struct frame *frame_set_add(struct frame_set *set)
+{
+	if (set->free_len == 0)
+		return NULL;
+
+	struct frame *frame = &set->slots[set->free[--set->free_len]];
+	*frame = (struct frame){ .fd = -1, .set = set };
+
+	return frame;
+}
+
+int frame_set_watch_fence(struct frame_set *set, struct frame *frame, int fd)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLONESHOT,
+		.data.ptr = frame,
+	};
+
+	if (epoll_ctl(set->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		perror("epoll_ctl");
+		close(fd);
+		return -1;
+	}
+
+	frame->fd = fd;
+	frame->pending |= FRAME_PENDING_FENCE;
+	++set->fences;
+
+	return 0;
+}
+
+static void queue_completed(struct frame_set *set, struct frame *frame)
+{
+	frame->next = NULL;
+	*set->completed_tail = frame;
+	set->completed_tail = &frame->next;
+}
+
+void frame_set_submit(struct frame_set *set, struct frame *frame)
+{
+	if (!frame->pending)
+		queue_completed(set, frame);
+}
+
+void frame_set_clear(struct frame_set *set, struct frame *frame, uint32_t pending)
+{
+	/* Closing the fd also drops it from epoll */
+	if ((pending & FRAME_PENDING_FENCE) && frame->fd >= 0) {
+		close(frame->fd);
+		frame->fd = -1;
+		--set->fences;
+	}
+
+	if (!(frame->pending & pending))
+		return;
+
+	frame->pending &= ~pending;
+	if (!frame->pending)
+		queue_completed(set, frame);
+}
+
+struct frame *frame_set_pop_completed(struct frame_set *set)
+{
+	struct frame *frame = set->completed;
+	if (!frame)
+		return NULL;
+
+	set->completed = frame->next;
+	if (!set->completed)
+		set->completed_tail = &set->completed;
+
+	return frame;
+}
+
+void frame_set_remove(struct frame_set *set, struct frame *frame)
+{
+	if (frame->fd >= 0) {
+		close(frame->fd);
+		frame->fd = -1;
+		--set->fences;
+	}
+
+	set->free[set->free_len++] = frame - set->slots;
+}
@@ -0,0 +1,152 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Enough for 100k frames in flight, with some headroom */
+#define MAX_FRAMES 131072
+
+/* What a submitted frame is still waiting for */
+enum frame_pending {
+	FRAME_PENDING_FENCE = 1 << 0,
+	FRAME_PENDING_DONE = 1 << 1,
+	FRAME_PENDING_PRESENTED = 1 << 2,
+	FRAME_PENDING_QUERY = 1 << 3,
+	FRAME_PENDING_RELEASE = 1 << 4,
+	FRAME_PENDING_READBACK = 1 << 5,
+};
+
+struct frame_set;
+
+struct frame {
+	int frame_num;
+	/* Index of the -n surface it was drawn on */
+	int surface;
+	/* Index of the --script phase it was submitted in, or -1 */
+	int phase;
+	int iter;
+	int aa;
+	int32_t width;
+	int32_t height;
+	/* Fences outstanding right after this frame was submitted, itself included */
+	uint32_t depth;
+
+	/*
+	 * CPU submission, render completion and wl_callback.done times. The
+	 * latter two are 0 when unknown.
+	 */
+	uint64_t start_ns;
+	uint64_t end_ns;
+	uint64_t done_ns;
+	/* wl_callback.done's own timestamp, in ms with an undefined base */
+	uint32_t done_time;
+
+	/*
+	 * From GPU timer queries, 0 when unknown. gpu_start_ns is in
+	 * CLOCK_MONOTONIC.
+	 */
+	uint64_t gpu_start_ns;
+	uint64_t gpu_time_ns;
+
+	/*
+	 * wp_presentation_feedback results. presented_ns is 0 unless the
+	 * frame was presented, and is converted from the compositor's
+	 * presentation clock to CLOCK_MONOTONIC when the frame retires.
+	 */
+	uint64_t presented_ns;
+	uint32_t refresh_ns;
+	uint32_t present_flags;
+	bool discarded;
+
+	/*
+	 * With --explicit-sync, when zwp_linux_buffer_release_v1 came in, 0
+	 * until then. A fenced release only makes the buffer reusable once
+	 * that fence signals, which isn't waited for.
+	 */
+	uint64_t released_ns;
+	bool release_fenced;
+
+	/*
+	 * With --checksum, a hash of the rendered pixels, 0 when unknown. With
+	 * --verify, whether the frame was compared against the CPU rendering,
+	 * and how that went.
+	 */
+	uint64_t checksum;
+	bool verified;
+	double psnr;
+	uint32_t mismatched;
+
+	/* sync_file for the rendering, or -1 */
+	int fd;
+	uint32_t pending;
+
+	struct frame_set *set;
+	/* Link in frame_set.completed */
+	struct frame *next;
+};
+
+/*
+ * Frames live in a preallocated slot map, so pointers to them stay valid
+ * and adding or retiring one is O(1). Each sync_file is registered once
+ * with epoll as EPOLLONESHOT, with the frame as its data.ptr.
+ */
+struct frame_set {
+	int epoll_fd;
+
+	struct frame *slots;
+	uint32_t *free;
+	size_t free_len;
+	size_t cap;
+	/* Frames whose fence hasn't been closed yet */
+	size_t fences;
+
+	/* Frames with nothing pending, oldest first */
+	struct frame *completed;
+	struct frame **completed_tail;
+};
+
+int frame_set_init(struct frame_set *set, int epoll_fd, size_t cap);
+
+/* Closes any fences still in flight */
+void frame_set_finish(struct frame_set *set);
+
+/* Returns NULL if the set is full */
+struct frame *frame_set_add(struct frame_set *set);
+
+/*
+ * Takes ownership of fd and waits for it with epoll. Returns -1 and
+ * closes fd on failure.
+ */
+int frame_set_watch_fence(struct frame_set *set, struct frame *frame, int fd);
+
+/*
+ * Called once everything the frame waits for is set up. Frames which
+ * aren't waiting for anything are queued as completed straight away.
+ */
+void frame_set_submit(struct frame_set *set, struct frame *frame);
+
+/*
+ * Marks part of a frame as no longer pending, closing its fence if that is
+ * one of them. Once nothing is pending the frame is queued as completed.
+ */
+void frame_set_clear(struct frame_set *set, struct frame *frame, uint32_t pending);
+
+/* Pops the oldest completed frame, or returns NULL */
+struct frame *frame_set_pop_completed(struct frame_set *set);
+
+/* Frees the frame's slot */
+void frame_set_remove(struct frame_set *set, struct frame *frame);
+
+static inline size_t frame_set_count(const struct frame_set *set)
+{
+	return set->cap - set->free_len;
+}
+
+static inline size_t frame_set_fences(const struct frame_set *set)
+{
+	return set->fences;
+}
+
+#endif
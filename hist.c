@@ -0,0 +1,107 @@
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include "hist.h"
+
+static size_t bucket_index(uint64_t value)
+{
+	if (value < HIST_SUB_COUNT)
+		return value;
+
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - HIST_SUB_BITS;
+	uint64_t sub = (value >> shift) & (HIST_SUB_COUNT - 1);
+
+	return (size_t)(shift + 1) * HIST_SUB_COUNT + sub;
+}
+
+/* Middle of the range of values which map to this bucket */
+static uint64_t bucket_value(size_t index)
+{
+	if (index < HIST_SUB_COUNT)
+		return index;
+
+	int shift = index / HIST_SUB_COUNT - 1;
+	uint64_t sub = index % HIST_SUB_COUNT;
+	uint64_t lower = (HIST_SUB_COUNT | sub) << shift;
+
+	return lower + ((UINT64_C(1) << shift) >> 1);
+}
+
+void hist_init(struct hist *hist)
+{
+	memset(hist, 0, sizeof *hist);
+	hist->min = UINT64_MAX;
+}
+
+void hist_record(struct hist *hist, uint64_t value)
+{
+	++hist->buckets[bucket_index(value)];
+	++hist->count;
+	hist->sum += value;
+	if (value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+	if (src->count == 0)
+		return;
+
+	for (size_t i = 0; i < HIST_BUCKETS; ++i)
+		dst->buckets[i] += src->buckets[i];
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+uint64_t hist_percentile(const struct hist *hist, double p)
+{
+	if (hist->count == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t)ceil(p * hist->count);
+	uint64_t seen = 0;
+
+	if (rank == 0)
+		rank = 1;
+
+	for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+		seen += hist->buckets[i];
+		if (seen < rank)
+			continue;
+
+		/* The exact extremes are known, so don't report past them */
+		uint64_t value = bucket_value(i);
+		if (value > hist->max)
+			value = hist->max;
+		if (value < hist->min)
+			value = hist->min;
+		return value;
+	}
+
+	return hist->max;
+}
+
+void hist_print(const struct hist *hist, const char *name, FILE *f)
+{
+	if (hist->count == 0) {
+		fprintf(f, "%s: no samples\n", name);
+		return;
+	}
+
+	fprintf(f, "%s: n %" PRIu64 ", mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f ms\n",
+		name, hist->count, hist->sum / hist->count * 1e-6,
+		hist_percentile(hist, 0.50) * 1e-6,
+		hist_percentile(hist, 0.90) * 1e-6,
+		hist_percentile(hist, 0.99) * 1e-6,
+		hist_percentile(hist, 0.999) * 1e-6,
+		hist->max * 1e-6);
+}
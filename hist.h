@@ -0,0 +1,38 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log-linear histogram in the style of HdrHistogram. Values below
+ * 2^HIST_SUB_BITS are counted exactly, anything larger lands in one of
+ * 2^HIST_SUB_BITS buckets per power of two, so every value is recorded
+ * to within 1%. Memory is fixed and recording is O(1).
+ */
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+struct hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+void hist_init(struct hist *hist);
+
+void hist_record(struct hist *hist, uint64_t value);
+
+/* Adds every value recorded in src to dst */
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/* p is a fraction, e.g. 0.999 for p99.9 */
+uint64_t hist_percentile(const struct hist *hist, double p);
+
+/* Prints a one line summary of nanosecond values, in milliseconds */
+void hist_print(const struct hist *hist, const char *name, FILE *f);
+
+#endif
@@ -0,0 +1,275 @@
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "io.h"
+
+static void notify(int fd)
+{
+	uint64_t one = 1;
+
+	/* Only fails if the counter would overflow, which wakes the reader anyway */
+	if (write(fd, &one, sizeof one) == -1 && errno != EAGAIN)
+		perror("write");
+}
+
+static void drain(int fd)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) == -1 && errno != EAGAIN)
+		perror("read");
+}
+
+void io_thread_push(struct io_thread *io, const struct io_event *event)
+{
+	size_t head = atomic_load_explicit(&io->head, memory_order_relaxed);
+
+	/* Only if the render thread has fallen a very long way behind */
+	while (head - atomic_load_explicit(&io->tail, memory_order_acquire) == IO_QUEUE_SIZE)
+		sched_yield();
+
+	io->ring[head % IO_QUEUE_SIZE] = *event;
+	atomic_store_explicit(&io->head, head + 1, memory_order_release);
+}
+
+static bool pop(struct io_thread *io, struct io_event *event)
+{
+	size_t tail = atomic_load_explicit(&io->tail, memory_order_relaxed);
+
+	if (tail == atomic_load_explicit(&io->head, memory_order_acquire))
+		return false;
+
+	*event = io->ring[tail % IO_QUEUE_SIZE];
+	atomic_store_explicit(&io->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+static void *io_main(void *data)
+{
+	struct io_thread *io = data;
+	int display_fd = wl_display_get_fd(io->wl_display);
+	bool display_pollout = true;
+
+	while (!atomic_load(&io->quit)) {
+		struct epoll_event events[64];
+		bool display_readable = false;
+		bool display_error = false;
+		size_t pushed = atomic_load_explicit(&io->head, memory_order_relaxed);
+		int ret;
+
+		while (wl_display_prepare_read(io->wl_display) != 0 && errno == EAGAIN)
+			wl_display_dispatch_pending(io->wl_display);
+
+		/* Requests from either thread */
+		errno = 0;
+		do {
+			ret = wl_display_flush(io->wl_display);
+		} while (ret > 0);
+
+		if (ret == -1 && errno != EAGAIN) {
+			wl_display_cancel_read(io->wl_display);
+			break;
+		}
+
+		if ((ret == -1) != display_pollout) {
+			struct epoll_event ev = {
+				.events = ret == -1 ? EPOLLIN | EPOLLOUT : EPOLLIN,
+				.data.ptr = NULL,
+			};
+
+			epoll_ctl(io->epoll_fd, EPOLL_CTL_MOD, display_fd, &ev);
+			display_pollout = ret == -1;
+		}
+
+		ret = epoll_wait(io->epoll_fd, events, 64, -1);
+		if (ret == -1 && errno != EINTR) {
+			perror("epoll_wait");
+			wl_display_cancel_read(io->wl_display);
+			break;
+		}
+
+		for (int i = 0; i < ret; ++i) {
+			void *ptr = events[i].data.ptr;
+
+			if (!ptr) {
+				display_readable = events[i].events & EPOLLIN;
+				display_error = events[i].events & (EPOLLERR | EPOLLHUP);
+			} else if (ptr == io) {
+				drain(io->kick_fd);
+			} else if (ptr == io->probe) {
+				probe_tick(io->probe);
+			} else if (ptr == io->pacer) {
+				struct io_event ev = {
+					.type = IO_EVENT_PACE,
+					.count = pacer_tick(io->pacer),
+				};
+				io_thread_push(io, &ev);
+			} else {
+				struct io_event ev = { .type = IO_EVENT_FENCE, .data = ptr };
+				io_thread_push(io, &ev);
+			}
+		}
+
+		if (display_error) {
+			wl_display_cancel_read(io->wl_display);
+			break;
+		}
+
+		if (display_readable)
+			wl_display_read_events(io->wl_display);
+		else
+			wl_display_cancel_read(io->wl_display);
+		if (io->probe)
+			probe_dispatch(io->probe);
+		wl_display_dispatch_pending(io->wl_display);
+
+		if (atomic_load_explicit(&io->head, memory_order_relaxed) != pushed)
+			notify(io->wake_fd);
+	}
+
+	if (!atomic_load(&io->quit)) {
+		struct io_event ev = { .type = IO_EVENT_ERROR };
+		io_thread_push(io, &ev);
+		notify(io->wake_fd);
+	}
+
+	return NULL;
+}
+
+int io_thread_start(struct io_thread *io, struct wl_display *wl_display,
+		int epoll_fd, struct probe *probe, struct pacer *pacer)
+{
+	*io = (struct io_thread){
+		.wl_display = wl_display,
+		.epoll_fd = epoll_fd,
+		.probe = probe,
+		.pacer = pacer,
+		.wake_fd = -1,
+		.kick_fd = -1,
+	};
+
+	io->ring = calloc(IO_QUEUE_SIZE, sizeof *io->ring);
+	if (!io->ring) {
+		perror("calloc");
+		return -1;
+	}
+
+	io->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	io->kick_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (io->wake_fd == -1 || io->kick_fd == -1) {
+		perror("eventfd");
+		goto error;
+	}
+
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = io,
+	};
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, io->kick_fd, &ev) == -1) {
+		perror("epoll_ctl");
+		goto error;
+	}
+
+	/* Signals should interrupt the render thread, not us */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int ret = pthread_create(&io->thread, NULL, io_main, io);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+		goto error;
+	}
+
+	return 0;
+
+error:
+	if (io->wake_fd >= 0)
+		close(io->wake_fd);
+	if (io->kick_fd >= 0)
+		close(io->kick_fd);
+	free(io->ring);
+	io->ring = NULL;
+	return -1;
+}
+
+void io_thread_stop(struct io_thread *io)
+{
+	if (!io->ring)
+		return;
+
+	atomic_store(&io->quit, true);
+	notify(io->kick_fd);
+	pthread_join(io->thread, NULL);
+
+	epoll_ctl(io->epoll_fd, EPOLL_CTL_DEL, io->kick_fd, NULL);
+	close(io->wake_fd);
+	close(io->kick_fd);
+	free(io->ring);
+	io->ring = NULL;
+}
+
+int io_thread_wait(struct io_thread *io, struct wl_event_queue *queue,
+		bool block, struct io_event *events, int max)
+{
+	struct wl_display *wl_display = io->wl_display;
+	int n = 0;
+
+	while (wl_display_prepare_read_queue(wl_display, queue) != 0) {
+		if (wl_display_dispatch_queue_pending(wl_display, queue) == -1)
+			return -1;
+		block = false;
+	}
+
+	/* If the socket is full, the I/O thread waits for it to drain */
+	if (wl_display_flush(wl_display) == -1) {
+		if (errno != EAGAIN) {
+			wl_display_cancel_read(wl_display);
+			return -1;
+		}
+		notify(io->kick_fd);
+	}
+
+	struct pollfd fds[] = {
+		{ .fd = wl_display_get_fd(wl_display), .events = POLLIN },
+		{ .fd = io->wake_fd, .events = POLLIN },
+	};
+
+	if (atomic_load_explicit(&io->tail, memory_order_relaxed) !=
+			atomic_load_explicit(&io->head, memory_order_acquire))
+		block = false;
+
+	if (poll(fds, 2, block ? -1 : 0) == -1 && errno != EINTR) {
+		perror("poll");
+		wl_display_cancel_read(wl_display);
+		return -1;
+	}
+
+	/* The I/O thread reads too, libwayland makes sure only one of us does */
+	if (fds[0].revents & POLLIN) {
+		if (wl_display_read_events(wl_display) == -1)
+			return -1;
+	} else {
+		wl_display_cancel_read(wl_display);
+	}
+	if (wl_display_dispatch_queue_pending(wl_display, queue) == -1)
+		return -1;
+
+	if (fds[1].revents & POLLIN)
+		drain(io->wake_fd);
+
+	while (n < max && pop(io, &events[n]))
+		++n;
+
+	return n;
+}
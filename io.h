@@ -0,0 +1,87 @@
+#ifndef IO_H
+#define IO_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+#include "frames.h"
+#include "pacer.h"
+#include "probe.h"
+
+/* Room for every frame's fence plus plenty of configures */
+#define IO_QUEUE_SIZE (2 * MAX_FRAMES)
+
+enum io_event_type {
+	IO_EVENT_CONFIGURE,
+	IO_EVENT_CLOSE,
+	/* The fence of the frame in data has signalled */
+	IO_EVENT_FENCE,
+	/* The pacer ticked, count frames came due */
+	IO_EVENT_PACE,
+	/* The connection is gone, the I/O thread has stopped */
+	IO_EVENT_ERROR,
+};
+
+struct io_event {
+	enum io_event_type type;
+	/* The surface, or the frame */
+	void *data;
+	uint32_t serial;
+	int32_t width;
+	int32_t height;
+	uint64_t count;
+};
+
+/*
+ * With -T, a thread of its own reads from the display, dispatches the
+ * default queue and waits for fences, so that pings and configures get
+ * handled even while the render thread is stuck in eglSwapBuffers().
+ * Everything it has for the render thread goes through a single producer,
+ * single consumer ring, in order.
+ */
+struct io_thread {
+	struct wl_display *wl_display;
+	int epoll_fd;
+	struct probe *probe;
+	struct pacer *pacer;
+	pthread_t thread;
+
+	/* Written by the I/O thread when it pushes events */
+	int wake_fd;
+	/* Written by the render thread to make the I/O thread flush or quit */
+	int kick_fd;
+	atomic_bool quit;
+
+	struct io_event *ring;
+	_Alignas(64) _Atomic size_t head;
+	_Alignas(64) _Atomic size_t tail;
+};
+
+/*
+ * Takes over the display fd registration in epoll_fd, which must already
+ * have the fences, probe and pacer timers in it. Signals stay with the
+ * caller.
+ */
+int io_thread_start(struct io_thread *io, struct wl_display *wl_display,
+	int epoll_fd, struct probe *probe, struct pacer *pacer);
+
+void io_thread_stop(struct io_thread *io);
+
+/* Only called on the I/O thread, i.e. from default queue listeners */
+void io_thread_push(struct io_thread *io, const struct io_event *event);
+
+/*
+ * The render thread's side of the event loop: flushes, dispatches queue,
+ * and pops up to max events. Blocks until there is at least one event or
+ * something on queue was dispatched, unless block is false. Returns the
+ * number of events, or -1 if the connection failed.
+ */
+int io_thread_wait(struct io_thread *io, struct wl_event_queue *queue,
+	bool block, struct io_event *events, int max);
+
+#endif
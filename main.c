@@ -1,15 +1,17 @@
 #include <errno.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <math.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#include <linux/sync_file.h>
-#include <poll.h>
-#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 #include <wayland-client.h>
@@ -18,71 +20,124 @@
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 
+#include "linux-explicit-synchronization-protocol.h"
+#include "presentation-time-protocol.h"
 #include "xdg-shell-protocol.h"
 
+#include "camera.h"
+#include "clients.h"
+#include "control.h"
+#include "cpu.h"
+#include "frames.h"
+#include "io.h"
+#include "pacer.h"
+#include "pool.h"
+#include "probe.h"
+#include "script.h"
+#include "shader.h"
+#include "shm.h"
+#include "stats.h"
+#include "syncfile.h"
+#include "timer.h"
+#include "trace.h"
+#include "util.h"
+#include "verify.h"
+#include "victim.h"
+
+/* Long options without a short equivalent */
+enum {
+	OPT_VICTIM = 256,
+	OPT_CLIENTS,
+	OPT_STAGGER,
+	OPT_MAX_INFLIGHT,
+	OPT_FPS,
+	OPT_BURST,
+	OPT_POISSON,
+	OPT_REPLAY,
+	OPT_EXPLICIT_SYNC,
+	OPT_SCRIPT,
+	OPT_CAMERA,
+	OPT_HEADLESS,
+	OPT_VERIFY,
+	OPT_CHECKSUM,
+};
+
+static const struct option long_options[] = {
+	{ "victim", no_argument, NULL, OPT_VICTIM },
+	{ "clients", required_argument, NULL, OPT_CLIENTS },
+	{ "stagger", required_argument, NULL, OPT_STAGGER },
+	{ "max-inflight", required_argument, NULL, OPT_MAX_INFLIGHT },
+	{ "fps", required_argument, NULL, OPT_FPS },
+	{ "burst", required_argument, NULL, OPT_BURST },
+	{ "poisson", required_argument, NULL, OPT_POISSON },
+	{ "replay", required_argument, NULL, OPT_REPLAY },
+	{ "explicit-sync", no_argument, NULL, OPT_EXPLICIT_SYNC },
+	{ "script", required_argument, NULL, OPT_SCRIPT },
+	{ "camera", required_argument, NULL, OPT_CAMERA },
+	{ "headless", no_argument, NULL, OPT_HEADLESS },
+	{ "verify", required_argument, NULL, OPT_VERIFY },
+	{ "checksum", no_argument, NULL, OPT_CHECKSUM },
+	{ 0 },
+};
+
+/* Buffers the CPU renderer cycles through, in case the compositor holds on to some */
+#define NUM_SHM_BUFFERS 3
+
+static volatile sig_atomic_t quit_requested;
+static volatile sig_atomic_t summary_requested;
+
 struct wl_state {
 	struct wl_compositor *wl_compositor;
 	struct xdg_wm_base *xdg_wm_base;
+	struct wl_shm *wl_shm;
+	struct wp_presentation *presentation;
+	clockid_t presentation_clock;
+	struct zwp_linux_explicit_synchronization_v1 *explicit_sync;
 
+	/* Any of the surfaces was closed */
 	bool close;
+
+	/* With -T, default queue events are handed over through this */
+	struct io_thread *io;
+};
+
+/* One of the -n toplevels, each with its own frame callback */
+struct surface {
+	struct wl_state *wl_state;
+	int index;
+
+	struct wl_surface *wl_surface;
+	/* wl_surface, or a wrapper of it on the render thread's queue */
+	struct wl_surface *frame_surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	struct wl_egl_window *egl_window;
+	EGLSurface egl_surface;
+	struct shm_buffer *shm_buffers[NUM_SHM_BUFFERS];
+	/* With --explicit-sync, on the render thread's queue like frame_surface */
+	struct zwp_linux_surface_synchronization_v1 *surface_sync;
+
 	uint32_t serial;
 	int32_t width;
 	int32_t height;
+	/* From xdg_toplevel.configure, until the matching xdg_surface.configure */
+	int32_t pending_width;
+	int32_t pending_height;
 
 	struct wl_callback *frame;
-};
+	/* The frame whose wl_callback.done we're waiting for */
+	struct frame *frame_record;
 
-static const GLchar *vert_src =
-"precision highp float;\n"
-"attribute vec2 in_pos;\n"
-"void main() {\n"
-"	gl_Position = vec4(in_pos, 0.0, 1.0);\n"
-"}\n";
+	struct stats stats;
+};
 
-/*
- * https://iquilezles.org/www/articles/mset_smooth/mset_smooth.htm
- * https://shadertoy.com/view/4df3Rn
- */
-static const GLchar *frag_src =
-"precision highp float;\n"
-"uniform int frame_num;\n"
-"uniform int iter;\n"
-"uniform int aa;\n"
-"uniform vec2 win_size;\n"
-"void main() {\n"
-"	vec3 col = vec3(0.0, 0.0, 0.0);\n"
-"	for (int m = 0; m < aa; ++m)\n"
-"	for (int n = 0; n < aa; ++n) {\n"
-"		float ftime = float(frame_num) / 10.0;\n"
-"		vec2 p = (-win_size + 2.0 * (gl_FragCoord.xy + vec2(float(m), float(n)) / float(aa))) / win_size.y;\n"
-"		float w = float(aa * m + n);\n"
-"		float time = ftime + 0.5 * (1.0 / 24.0) * w / float(aa * aa);\n"
-"\n"
-"		float zoo = 0.62 + 0.38 * cos(0.07 * time);\n"
-"		float coa = cos(0.15 * (1.0 - zoo) * time);\n"
-"		float sia = sin(0.15 * (1.0 - zoo) * time);\n"
-"		zoo = pow(zoo, 8.0);\n"
-"		vec2 xy = vec2(p.x * coa - p.y * sia, p.x * sia + p.y * coa);\n"
-"		vec2 c = vec2(-0.745, 0.186) + xy * zoo;\n"
-"\n"
-"		const float B = 256.0;\n"
-"		float l = 0.0;\n"
-"		vec2 z = vec2(0.0);\n"
-"		for (int i = 0; i < iter; ++i) {\n"
-"			z = vec2(z.x * z.x - z.y * z.y, 2.0 * z.x * z.y) + c;\n"
-"			if (dot(z, z) > B * B)\n"
-"				break;\n"
-"			l += 1.0;\n"
-"		}\n"
-"\n"
-"		float sl = l - log2(log2(dot(z, z))) + 4.0;\n"
-"		float al = smoothstep(-0.1, 0.0, sin(0.5 * 6.2831));\n"
-"		l = mix(l, sl, al);\n"
-"		col += 0.5 + 0.5 * cos(3.0 + l * 0.15 + vec3(0.0, 0.6, 1.0));\n"
-"	}\n"
-"	col /= float(aa * aa);\n"
-"	gl_FragColor = vec4(col, 1.0);\n"
-"}\n";
+static void handle_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		summary_requested = 1;
+	else
+		quit_requested = 1;
+}
 
 static void xdg_ping(void *data, struct xdg_wm_base *shell, uint32_t serial)
 {
@@ -93,6 +148,17 @@ static const struct xdg_wm_base_listener shell_listener = {
 	.ping = xdg_ping,
 };
 
+static void presentation_clock_id(void *data, struct wp_presentation *presentation,
+		uint32_t clk_id)
+{
+	struct wl_state *wl_state = data;
+	wl_state->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	.clock_id = presentation_clock_id,
+};
+
 static void global_add(void *data, struct wl_registry *reg, uint32_t name,
 		const char *iface, uint32_t version)
 {
@@ -104,6 +170,17 @@ static void global_add(void *data, struct wl_registry *reg, uint32_t name,
 	} else if (strcmp(iface, xdg_wm_base_interface.name) == 0) {
 		wl_state->xdg_wm_base = wl_registry_bind(reg, name, &xdg_wm_base_interface, 1);
 		xdg_wm_base_add_listener(wl_state->xdg_wm_base, &shell_listener, NULL);
+
+	} else if (strcmp(iface, wl_shm_interface.name) == 0) {
+		wl_state->wl_shm = wl_registry_bind(reg, name, &wl_shm_interface, 1);
+
+	} else if (strcmp(iface, wp_presentation_interface.name) == 0) {
+		wl_state->presentation = wl_registry_bind(reg, name, &wp_presentation_interface, 1);
+		wp_presentation_add_listener(wl_state->presentation, &presentation_listener, wl_state);
+
+	} else if (strcmp(iface, zwp_linux_explicit_synchronization_v1_interface.name) == 0) {
+		wl_state->explicit_sync = wl_registry_bind(reg, name,
+			&zwp_linux_explicit_synchronization_v1_interface, 1);
 	}
 }
 
@@ -119,8 +196,24 @@ static const struct wl_registry_listener registry_listener = {
 
 static void xdg_base_configure(void *data, struct xdg_surface *surf, uint32_t serial)
 {
-	struct wl_state *wl_state = data;
-	wl_state->serial = serial;
+	struct surface *surface = data;
+
+	if (surface->wl_state->io) {
+		struct io_event ev = {
+			.type = IO_EVENT_CONFIGURE,
+			.data = surface,
+			.serial = serial,
+			.width = surface->pending_width,
+			.height = surface->pending_height,
+		};
+
+		io_thread_push(surface->wl_state->io, &ev);
+		return;
+	}
+
+	surface->serial = serial;
+	surface->width = surface->pending_width;
+	surface->height = surface->pending_height;
 }
 
 static const struct xdg_surface_listener xdg_base_listener = {
@@ -130,15 +223,22 @@ static const struct xdg_surface_listener xdg_base_listener = {
 static void toplevel_configure(void *data, struct xdg_toplevel *top,
 		int32_t width, int32_t height, struct wl_array *states)
 {
-	struct wl_state *wl_state = data;
-	wl_state->width = width;
-	wl_state->height = height;
+	struct surface *surface = data;
+	surface->pending_width = width;
+	surface->pending_height = height;
 }
 
 static void toplevel_close(void *data, struct xdg_toplevel *top)
 {
-	struct wl_state *wl_state = data;
-	wl_state->close = true;
+	struct surface *surface = data;
+
+	if (surface->wl_state->io) {
+		struct io_event ev = { .type = IO_EVENT_CLOSE, .data = surface };
+		io_thread_push(surface->wl_state->io, &ev);
+		return;
+	}
+
+	surface->wl_state->close = true;
 }
 
 static const struct xdg_toplevel_listener toplevel_listener = {
@@ -146,75 +246,143 @@ static const struct xdg_toplevel_listener toplevel_listener = {
 	.close = toplevel_close,
 };
 
-static bool has_ext(const char *exts, const char *ext)
+static void frame_done(void *data, struct wl_callback *cb, uint32_t time)
 {
-	while (*exts) {
-		const char *end = strchr(exts, ' ');
-		size_t len = end ? (size_t)(end - exts) : strlen(exts);
+	struct surface *surface = data;
+	struct frame *frame = surface->frame_record;
 
-		if (strncmp(exts, ext, len) == 0)
-			return true;
-		exts += len + !!end;
-	}
+	frame->done_ns = get_time_ns();
+	frame->done_time = time;
+	frame_set_clear(frame->set, frame, FRAME_PENDING_DONE);
 
-	return false;
+	wl_callback_destroy(surface->frame);
+	surface->frame = NULL;
+	surface->frame_record = NULL;
 }
 
-static GLuint compile_shader(const GLchar *src, GLenum type, const char *tag)
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_done,
+};
+
+static void feedback_sync_output(void *data, struct wp_presentation_feedback *feedback,
+		struct wl_output *output)
 {
-	GLuint shader = glCreateShader(type);
-	glShaderSource(shader, 1, &src, NULL);
-	glCompileShader(shader);
+	/* Don't care */
+}
 
-	GLint status = GL_TRUE;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-	if (!status) {
-		char log[1000];
-		GLsizei len;
-		glGetShaderInfoLog(shader, sizeof log, &len, log);
-		fprintf(stderr, "%s: %s\n", tag, log);
+static void feedback_presented(void *data, struct wp_presentation_feedback *feedback,
+		uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh,
+		uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+{
+	struct frame *frame = data;
 
-		return 0;
-	}
+	frame->presented_ns = ((uint64_t)tv_sec_hi << 32 | tv_sec_lo) * 1000000000 + tv_nsec;
+	frame->refresh_ns = refresh;
+	frame->present_flags = flags;
+	frame_set_clear(frame->set, frame, FRAME_PENDING_PRESENTED);
 
-	return shader;
+	wp_presentation_feedback_destroy(feedback);
 }
 
-static void frame_done(void *data, struct wl_callback *cb, uint32_t time)
+static void feedback_discarded(void *data, struct wp_presentation_feedback *feedback)
 {
-	struct wl_state *wl_state = data;
-	wl_callback_destroy(wl_state->frame);
-	wl_state->frame = NULL;
+	struct frame *frame = data;
+
+	frame->discarded = true;
+	frame_set_clear(frame->set, frame, FRAME_PENDING_PRESENTED);
+
+	wp_presentation_feedback_destroy(feedback);
 }
 
-static const struct wl_callback_listener frame_listener = {
-	.done = frame_done,
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	.sync_output = feedback_sync_output,
+	.presented = feedback_presented,
+	.discarded = feedback_discarded,
 };
 
-static uint64_t fence_timestamp(int fd)
+static void release_fenced(void *data, struct zwp_linux_buffer_release_v1 *release,
+		int32_t fence)
 {
-	struct sync_file_info file = {0};
+	struct frame *frame = data;
 
-	if (ioctl(fd, SYNC_IOC_FILE_INFO, &file) == -1) {
-		perror("SYNC_IOC_FILE_INFO");
-		return 0;
-	}
+	frame->released_ns = get_time_ns();
+	frame->release_fenced = true;
+	frame_set_clear(frame->set, frame, FRAME_PENDING_RELEASE);
+
+	/* EGL picks the buffer to reuse, so there's nothing to wait on this for */
+	close(fence);
+	zwp_linux_buffer_release_v1_destroy(release);
+}
+
+static void release_immediate(void *data, struct zwp_linux_buffer_release_v1 *release)
+{
+	struct frame *frame = data;
+
+	frame->released_ns = get_time_ns();
+	frame_set_clear(frame->set, frame, FRAME_PENDING_RELEASE);
+
+	zwp_linux_buffer_release_v1_destroy(release);
+}
+
+static const struct zwp_linux_buffer_release_v1_listener release_listener = {
+	.fenced_release = release_fenced,
+	.immediate_release = release_immediate,
+};
+
+/*
+ * Rounds to the nearest power of 2^(1/8), so that retuning only ever needs
+ * a handful of specialised programs.
+ */
+static int quantize_iter(int iter)
+{
+	if (iter <= 1)
+		return 1;
+
+	return (int)lround(exp2(round(log2(iter) * 8.0) / 8.0));
+}
+
+static void print_surface_stats(const struct surface *surface, uint64_t now_ns)
+{
+	char name[32];
+
+	snprintf(name, sizeof name, "Surface %d", surface->index);
+	stats_print(&surface->stats, name, now_ns, stdout);
+}
+
+/* Phases which haven't been reached yet have nothing to print */
+static void print_phase_stats(const struct script *script, uint64_t now_ns)
+{
+	char name[32];
+
+	for (size_t i = 0; i < script->len; ++i) {
+		const struct phase *phase = &script->phases[i];
 
-	struct sync_fence_info fences[file.num_fences];
-	file.sync_fence_info = (__u64)(uintptr_t)fences;
+		if (!script->stats[i].start_ns)
+			continue;
 
-	if (ioctl(fd, SYNC_IOC_FILE_INFO, &file) == -1) {
-		perror("SYNC_IOC_FILE_INFO");
-		return 0;
+		snprintf(name, sizeof name, "Phase %zu", i);
+		stats_print(&script->stats[i], name, phase->end_ns ? phase->end_ns : now_ns, stdout);
 	}
+}
+
+static void print_readback(const struct frame *frame)
+{
+	if (frame->checksum)
+		printf("Frame %d: checksum %016" PRIx64 "\n", frame->frame_num, frame->checksum);
+	if (frame->verified)
+		printf("Frame %d: PSNR %.2f dB, %" PRIu32 " mismatched pixels\n",
+			frame->frame_num, frame->psnr, frame->mismatched);
+}
 
-	uint64_t latest = 0;
-	for (__u32 i = 0; i < file.num_fences; ++i) {
-		if (fences[i].timestamp_ns > latest)
-			latest = fences[i].timestamp_ns;
+/* Returns a slot holding a buffer the compositor is done with, or an empty slot */
+static struct shm_buffer **find_free_buffer(struct shm_buffer **bufs, size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		if (!bufs[i] || !bufs[i]->busy)
+			return &bufs[i];
 	}
 
-	return latest;
+	return NULL;
 }
 
 int main(int argc, char *argv[])
@@ -226,11 +394,35 @@ int main(int argc, char *argv[])
 	int max_frames = INT_MAX;
 	bool unsynchronized = false;
 	int aa = 1;
+	bool use_cpu = false;
+	/* 0 until -j is given */
+	int threads = 0;
+	double target_ms = 0.0;
+	bool specialize = false;
+	bool quiet = false;
+	const char *trace_path = NULL;
+	double probe_ms = 0.0;
+	bool with_victim = false;
+	int num_surfaces = 1;
+	int num_clients = 0;
+	double stagger_ms = 50.0;
+	bool io_threaded = false;
+	int max_inflight = 0;
+	static struct pacer pacer = { .timer_fd = -1 };
+	const char *pace_arg = NULL;
+	bool explicit_sync = false;
+	const char *script_path = NULL;
+	static struct script script;
+	static struct camera camera;
+	bool headless = false;
+	int verify_every = 0;
+	int verify_tolerance = VERIFY_DEFAULT_TOLERANCE;
+	bool checksum = false;
 
 	/* Command line parsing */
 	{
 		int opt;
-		while ((opt = getopt(argc, argv, "i:f:l:ua:")) != -1) {
+		while ((opt = getopt_long(argc, argv, "i:f:l:ua:cj:t:sqo:p:n:T", long_options, NULL)) != -1) {
 			switch (opt) {
 			case 'i':
 				iter = atoi(optarg);
@@ -249,25 +441,210 @@ int main(int argc, char *argv[])
 			case 'a':
 				aa = atoi(optarg);
 				break;
+			case 'c':
+				use_cpu = true;
+				break;
+			case 'j':
+				threads = atoi(optarg);
+				if (threads <= 0)
+					threads = sysconf(_SC_NPROCESSORS_ONLN);
+				break;
+			case 't':
+				target_ms = atof(optarg);
+				if (target_ms <= 0.0)
+					return 1;
+				break;
+			case 's':
+				specialize = true;
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 'o':
+				trace_path = optarg;
+				break;
+			case 'p':
+				probe_ms = atof(optarg);
+				if (probe_ms <= 0.0)
+					return 1;
+				break;
+			case 'n':
+				num_surfaces = atoi(optarg);
+				if (num_surfaces < 1)
+					return 1;
+				break;
+			case 'T':
+				io_threaded = true;
+				break;
+			case OPT_VICTIM:
+				with_victim = true;
+				break;
+			case OPT_CLIENTS:
+				num_clients = atoi(optarg);
+				if (num_clients < 1 || num_clients > UINT16_MAX)
+					return 1;
+				break;
+			case OPT_STAGGER:
+				stagger_ms = atof(optarg);
+				if (stagger_ms < 0.0)
+					return 1;
+				break;
+			case OPT_MAX_INFLIGHT:
+				max_inflight = atoi(optarg);
+				if (max_inflight < 1 || max_inflight > MAX_FRAMES)
+					return 1;
+				break;
+			case OPT_FPS:
+			case OPT_BURST:
+			case OPT_POISSON:
+			case OPT_REPLAY:
+				if (pacer.mode != PACER_NONE) {
+					fprintf(stderr, "--fps, --burst, --poisson and --replay are exclusive\n");
+					return 1;
+				}
+				if (pacer_parse(&pacer, PACER_FIXED + (opt - OPT_FPS), optarg) == -1)
+					return 1;
+				pace_arg = optarg;
+				break;
+			case OPT_EXPLICIT_SYNC:
+				explicit_sync = true;
+				break;
+			case OPT_SCRIPT:
+				script_path = optarg;
+				break;
+			case OPT_CAMERA:
+				if (camera_parse(&camera, optarg) == -1)
+					return 1;
+				break;
+			case OPT_HEADLESS:
+				headless = true;
+				break;
+			case OPT_VERIFY:
+				if (sscanf(optarg, "%d:%d", &verify_every, &verify_tolerance) < 1 ||
+						verify_every < 1 || verify_tolerance < 0 || verify_tolerance > 255)
+					return 1;
+				break;
+			case OPT_CHECKSUM:
+				checksum = true;
+				break;
 			default:
 				return 1;
 			}
 		}
+
+		/* Everything a --script needs has to be set up from the start */
+		if (script_path) {
+			struct phase defaults = {
+				.iter = iter,
+				.aa = aa,
+				.width = fixed_size ? fixed_width : 0,
+				.height = fixed_size ? fixed_height : 0,
+				.pace = pacer.mode,
+				.pace_arg = (char *)pace_arg,
+				.sync = explicit_sync ?
+					(unsynchronized ? PHASE_SYNC_EXPLICIT_UNSYNC : PHASE_SYNC_EXPLICIT) :
+					(unsynchronized ? PHASE_SYNC_UNSYNC : PHASE_SYNC_FRAME),
+				.surfaces = num_surfaces,
+			};
+
+			if (script_load(&script, script_path, &defaults) == -1)
+				return 1;
+
+			for (size_t i = 0; i < script.len; ++i) {
+				const struct phase *phase = &script.phases[i];
+
+				if (phase->surfaces > num_surfaces)
+					num_surfaces = phase->surfaces;
+				if (phase_explicit(phase))
+					explicit_sync = true;
+				if (use_cpu && phase->aa > CPU_MAX_AA) {
+					fprintf(stderr, "--script: aa must be between 1 and %d with -c\n",
+						CPU_MAX_AA);
+					return 1;
+				}
+			}
+		}
+
+		/* The pacer would have to be switched under the I/O thread's feet */
+		if (script_path && io_threaded) {
+			fprintf(stderr, "--script: not supported with -T\n");
+			return 1;
+		}
+
+		/* Only the CPU renderer has threads to spread frames over */
+		if (!use_cpu && threads > 0) {
+			fprintf(stderr, "-j: needs -c\n");
+			return 1;
+		}
+
+		if (use_cpu && (aa < 1 || aa > CPU_MAX_AA)) {
+			fprintf(stderr, "-a: must be between 1 and %d with -c\n", CPU_MAX_AA);
+			return 1;
+		}
+
+		/* wl_shm buffers can't carry fences */
+		if (use_cpu && explicit_sync) {
+			fprintf(stderr, "--explicit-sync: not supported with -c\n");
+			return 1;
+		}
+
+		/* CPU frames are done before they are submitted */
+		if (use_cpu && max_inflight > 0) {
+			fprintf(stderr, "--max-inflight: not supported with -c\n");
+			return 1;
+		}
+
+		if (headless && (use_cpu || with_victim || io_threaded || probe_ms > 0.0 ||
+				explicit_sync || num_surfaces > 1)) {
+			fprintf(stderr, "--headless: -c, -n, -p, -T, --victim and --explicit-sync need a compositor\n");
+			return 1;
+		}
+
+		/* The CPU renderer would only be compared against itself */
+		if (use_cpu && verify_every > 0) {
+			fprintf(stderr, "--verify: not supported with -c\n");
+			return 1;
+		}
+
+		/* Every worker would write to the same file */
+		if (num_clients > 0 && trace_path) {
+			fprintf(stderr, "-o: not supported with --clients\n");
+			return 1;
+		}
 	}
 
-	/* Wayland */
+	/* Fan out, the workers run everything below as usual */
+	struct clients clients = { .fd = -1, .index = -1 };
 
-	struct wl_display *wl_display;
-	struct wl_state wl_state = {0};
+	if (num_clients > 0) {
+		if (clients_fork(&clients, num_clients, stagger_ms) == -1)
+			return 1;
+		if (clients.index == -1)
+			return clients_aggregate(&clients);
+	}
 
-	wl_display = wl_display_connect(NULL);
-	if (!wl_display) {
-		perror("wl_display_connect");
-		return 1;
+	/*
+	 * Startup timing: connect, EGL init, fence clock calibration,
+	 * compile/link, first frame
+	 */
+	uint64_t startup_ns[6];
+	startup_ns[0] = get_time_ns();
+
+	/* Wayland, unless --headless */
+
+	struct wl_display *wl_display = NULL;
+	struct wl_state wl_state = { .presentation_clock = CLOCK_MONOTONIC };
+
+	if (!headless) {
+		wl_display = wl_display_connect(NULL);
+		if (!wl_display) {
+			perror("wl_display_connect");
+			return 1;
+		}
 	}
 	
 	/* Fetching Wayland globals */
-	{
+	if (!headless) {
 		struct wl_registry *wl_reg;
 		wl_reg = wl_display_get_registry(wl_display);
 		wl_registry_add_listener(wl_reg, &registry_listener, &wl_state);
@@ -282,20 +659,31 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "xdg_wm_base: %s\n", strerror(EPROTONOSUPPORT));
 			return 1;
 		}
+		if ((use_cpu || with_victim) && !wl_state.wl_shm) {
+			fprintf(stderr, "wl_shm: %s\n", strerror(EPROTONOSUPPORT));
+			return 1;
+		}
+		if (explicit_sync && !wl_state.explicit_sync) {
+			fprintf(stderr, "zwp_linux_explicit_synchronization_v1: %s\n",
+				strerror(EPROTONOSUPPORT));
+			return 1;
+		}
 	}
 
+	startup_ns[1] = get_time_ns();
+
 	/* EGL */
 
-	EGLDisplay egl_display;
-	EGLConfig egl_config;
-	EGLContext egl_context;
+	EGLDisplay egl_display = EGL_NO_DISPLAY;
+	EGLConfig egl_config = NULL;
+	EGLContext egl_context = EGL_NO_CONTEXT;
 	bool egl_has_fences = false;
 	PFNEGLCREATESYNCKHRPROC egl_create_sync = NULL;
 	PFNEGLDESTROYSYNCKHRPROC egl_destroy_sync = NULL;
 	PFNEGLDUPNATIVEFENCEFDANDROIDPROC egl_dup_fence = NULL;
 
 	/* Querying EGL client extensions */
-	{
+	if (!use_cpu) {
 		const char *exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
 		if (!exts) {
 			fprintf(stderr, "EGL_EXT_client_extensions: %s\n",
@@ -303,19 +691,28 @@ int main(int argc, char *argv[])
 			return 1;
 		}
 
-		if (!has_ext(exts, "EGL_EXT_platform_wayland")) {
+		if (!headless && !has_ext(exts, "EGL_EXT_platform_wayland")) {
 			fprintf(stderr, "EGL_EXT_platform_wayland: %s\n",
 				strerror(ENOTSUP));
 			return 1;
 		}
+
+		if (headless && !has_ext(exts, "EGL_MESA_platform_surfaceless")) {
+			fprintf(stderr, "EGL_MESA_platform_surfaceless: %s\n",
+				strerror(ENOTSUP));
+			return 1;
+		}
 	}
 
 	/* Initializing EGL */
-	{
+	if (!use_cpu) {
 		PFNEGLGETPLATFORMDISPLAYEXTPROC egl_get_display;
 		egl_get_display = (void *)eglGetProcAddress("eglGetPlatformDisplayEXT");
 
-		egl_display = egl_get_display(EGL_PLATFORM_WAYLAND_EXT, wl_display, NULL);
+		if (headless)
+			egl_display = egl_get_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		else
+			egl_display = egl_get_display(EGL_PLATFORM_WAYLAND_EXT, wl_display, NULL);
 		if (!egl_display) {
 			fprintf(stderr, "eglGetPlatformDisplayEXT: 0x%x\n", eglGetError());
 			return 1;
@@ -328,9 +725,15 @@ int main(int argc, char *argv[])
 	}
 
 	/* Querying EGL display extensions */
-	{
+	if (!use_cpu) {
 		const char *exts = eglQueryString(egl_display, EGL_EXTENSIONS);
 
+		/* There are no EGL surfaces to make current with --headless */
+		if (headless && !has_ext(exts, "EGL_KHR_surfaceless_context")) {
+			fprintf(stderr, "EGL_KHR_surfaceless_context: %s\n", strerror(ENOTSUP));
+			return 1;
+		}
+
 		if (has_ext(exts, "EGL_ANDROID_native_fence_sync")) {
 			egl_has_fences = true;
 			egl_create_sync = (void *)eglGetProcAddress("eglCreateSyncKHR");
@@ -340,12 +743,14 @@ int main(int argc, char *argv[])
 	}
 
 	/* Choosing an EGL config */
-	{
-		static const EGLint conf_attribs[] = {
+	if (!use_cpu) {
+		/* The surfaceless platform only has pbuffer configs */
+		const EGLint conf_attribs[] = {
 			EGL_RED_SIZE, 8,
 			EGL_GREEN_SIZE, 8,
 			EGL_BLUE_SIZE, 8,
 			EGL_ALPHA_SIZE, 0,
+			EGL_SURFACE_TYPE, headless ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
 			EGL_NONE
 		};
 		EGLint num_confs;
@@ -356,319 +761,1115 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	/* Creating an EGL context */
-	{
-		static const EGLint context_attribs[] = {
-			EGL_CONTEXT_CLIENT_VERSION, 2,
+	/*
+	 * Creating an EGL context. Reading frames back without stalling takes
+	 * ES 3.0, the rest only needs ES 2.0.
+	 */
+	if (!use_cpu) {
+		EGLint context_attribs[] = {
+			EGL_CONTEXT_CLIENT_VERSION, 3,
 			EGL_NONE
 		};
 
-		egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, context_attribs);
+		if (verify_every > 0 || checksum)
+			egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, context_attribs);
+		if (!egl_context) {
+			context_attribs[1] = 2;
+			egl_context = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, context_attribs);
+		}
 		if (!egl_context) {
 			fprintf(stderr, "eglCreateContext: 0x%x\n", eglGetError());
 			return 1;
 		}
 	}
 
-	/* Surface */
+	/* Surfaces */
+
+	struct surface *surfaces = calloc(num_surfaces, sizeof *surfaces);
+	if (!surfaces) {
+		perror("calloc");
+		return 1;
+	}
+
+	/* Creating Wayland surfaces */
+	for (int i = 0; i < num_surfaces; ++i) {
+		struct surface *surface = &surfaces[i];
 
-	struct wl_surface *surface_wl;
-	struct xdg_surface *surface_xdg_base;
-	struct xdg_toplevel *surface_xdg_toplevel;
-	struct wl_egl_window *surface_egl_native;
-	EGLSurface surface_egl;
+		surface->wl_state     = &wl_state;
+		surface->index        = i;
+		surface->egl_surface  = EGL_NO_SURFACE;
+		stats_init(&surface->stats);
 
-	/* Creating Wayland surface */
-	{
-		surface_wl           = wl_compositor_create_surface(wl_state.wl_compositor);
-		surface_xdg_base     = xdg_wm_base_get_xdg_surface(wl_state.xdg_wm_base, surface_wl);
-		surface_xdg_toplevel = xdg_surface_get_toplevel(surface_xdg_base);
+		if (headless)
+			continue;
 
-		xdg_surface_add_listener(surface_xdg_base, &xdg_base_listener, &wl_state);
-		xdg_toplevel_add_listener(surface_xdg_toplevel, &toplevel_listener, &wl_state);
+		surface->wl_surface   = wl_compositor_create_surface(wl_state.wl_compositor);
+		surface->xdg_surface  = xdg_wm_base_get_xdg_surface(wl_state.xdg_wm_base, surface->wl_surface);
+		surface->xdg_toplevel = xdg_surface_get_toplevel(surface->xdg_surface);
 
-		xdg_toplevel_set_title(surface_xdg_toplevel, "compositor-killer");
+		xdg_surface_add_listener(surface->xdg_surface, &xdg_base_listener, surface);
+		xdg_toplevel_add_listener(surface->xdg_toplevel, &toplevel_listener, surface);
+
+		xdg_toplevel_set_title(surface->xdg_toplevel, "compositor-killer");
 		if (fixed_size) {
-			xdg_toplevel_set_max_size(surface_xdg_toplevel, fixed_width, fixed_height);
-			xdg_toplevel_set_min_size(surface_xdg_toplevel, fixed_width, fixed_height);
+			xdg_toplevel_set_max_size(surface->xdg_toplevel, fixed_width, fixed_height);
+			xdg_toplevel_set_min_size(surface->xdg_toplevel, fixed_width, fixed_height);
 		}
 
-		wl_surface_commit(surface_wl);
-		wl_display_roundtrip(wl_display);
+		wl_surface_commit(surface->wl_surface);
 	}
 
-	/* Creating EGL surface */
-	{
-		PFNEGLCREATEPLATFORMWINDOWSURFACEPROC egl_create_surface;
-		egl_create_surface = (void *)eglGetProcAddress("eglCreatePlatformWindowSurfaceEXT");
+	if (!headless)
+		wl_display_roundtrip(wl_display);
+
+	for (int i = 0; i < num_surfaces; ++i) {
+		struct surface *surface = &surfaces[i];
 
 		if (fixed_size) {
-			wl_state.width = fixed_width;
-			wl_state.height = fixed_height;
+			surface->width = fixed_width;
+			surface->height = fixed_height;
+		}
+
+		if (surface->width == 0)
+			surface->width = 500;
+		if (surface->height == 0)
+			surface->height = 500;
+	}
+
+	/*
+	 * With -T, frame callbacks, feedback and buffer releases for our own
+	 * frames come in on a queue of their own, which only the render thread
+	 * dispatches. Everything else stays on the default queue.
+	 */
+	struct wl_event_queue *render_queue = NULL;
+	struct wp_presentation *presentation = wl_state.presentation;
+
+	if (io_threaded) {
+		render_queue = wl_display_create_queue(wl_display);
+		if (!render_queue) {
+			perror("wl_display_create_queue");
+			return 1;
 		}
 
-		if (wl_state.width == 0)
-			wl_state.width = 500;
-		if (wl_state.height == 0)
-			wl_state.height = 500;
+		if (presentation) {
+			presentation = wl_proxy_create_wrapper(wl_state.presentation);
+			wl_proxy_set_queue((struct wl_proxy *)presentation, render_queue);
+		}
+	}
+
+	for (int i = 0; i < num_surfaces; ++i) {
+		struct surface *surface = &surfaces[i];
 
-		surface_egl_native =
-			wl_egl_window_create(surface_wl, wl_state.width, wl_state.height);
-		if (!surface_egl_native) {
+		surface->frame_surface = surface->wl_surface;
+		if (io_threaded) {
+			surface->frame_surface = wl_proxy_create_wrapper(surface->wl_surface);
+			wl_proxy_set_queue((struct wl_proxy *)surface->frame_surface, render_queue);
+		}
+
+		/* zwp_linux_buffer_release_v1 objects inherit its queue */
+		if (explicit_sync) {
+			surface->surface_sync = zwp_linux_explicit_synchronization_v1_get_synchronization(
+				wl_state.explicit_sync, surface->wl_surface);
+			if (io_threaded)
+				wl_proxy_set_queue((struct wl_proxy *)surface->surface_sync, render_queue);
+		}
+	}
+
+	/* Creating the victim's surface */
+	static struct victim victim;
+	if (with_victim && victim_init(&victim, wl_state.wl_compositor, wl_state.xdg_wm_base,
+			wl_state.wl_shm, wl_state.presentation, wl_state.presentation_clock) == -1)
+		return 1;
+
+	/* Creating EGL surfaces */
+	for (int i = 0; !use_cpu && !headless && i < num_surfaces; ++i) {
+		struct surface *surface = &surfaces[i];
+		PFNEGLCREATEPLATFORMWINDOWSURFACEPROC egl_create_surface;
+		egl_create_surface = (void *)eglGetProcAddress("eglCreatePlatformWindowSurfaceEXT");
+
+		surface->egl_window =
+			wl_egl_window_create(surface->wl_surface, surface->width, surface->height);
+		if (!surface->egl_window) {
 			perror("wl_egl_window_create");
 			return 1;
 		}
 
-		surface_egl = egl_create_surface(egl_display, egl_config, surface_egl_native, NULL);
-		if (!surface_egl) {
+		surface->egl_surface = egl_create_surface(egl_display, egl_config, surface->egl_window, NULL);
+		if (!surface->egl_surface) {
 			fprintf(stderr, "eglCreatePlatformWindowSurfaceEXT: 0x%x",
 				eglGetError());
 			return 1;
 		}
+
+		/* The swap interval belongs to whichever surface is current */
+		eglMakeCurrent(egl_display, surface->egl_surface, surface->egl_surface, egl_context);
+		eglSwapInterval(egl_display, 0);
 	}
 
-	/* Making EGL surface current */
-	eglMakeCurrent(egl_display, surface_egl, surface_egl, egl_context);
-	eglSwapInterval(egl_display, 0);
+	/* Making the first EGL surface current, or none with --headless */
+	if (!use_cpu)
+		eglMakeCurrent(egl_display, surfaces[0].egl_surface, surfaces[0].egl_surface, egl_context);
+
+	/* With --headless, frames are drawn into a texture nobody looks at */
+	GLuint headless_fbo = 0;
+	GLuint headless_tex = 0;
+
+	if (headless) {
+		glGenTextures(1, &headless_tex);
+		glBindTexture(GL_TEXTURE_2D, headless_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surfaces[0].width, surfaces[0].height,
+			0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+		glGenFramebuffers(1, &headless_fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+			headless_tex, 0);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			fprintf(stderr, "glCheckFramebufferStatus: 0x%x\n",
+				glCheckFramebufferStatus(GL_FRAMEBUFFER));
+			return 1;
+		}
+	}
+
+	startup_ns[2] = get_time_ns();
+
+	/*
+	 * Check which clock fence timestamps are in. Clearing the back buffer
+	 * is harmless, as the first frame draws over all of it.
+	 */
+	struct fence_clock fence_clock;
+	struct fence_reader fence_reader = {0};
+	fence_clock_init(&fence_clock);
+
+	if (egl_has_fences) {
+		for (int i = 0; i < FENCE_CLOCK_SAMPLES; ++i) {
+			EGLSyncKHR sync;
+			int fd;
+
+			glClear(GL_COLOR_BUFFER_BIT);
+			sync = egl_create_sync(egl_display, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+			glFlush();
+			fd = egl_dup_fence(egl_display, sync);
+			egl_destroy_sync(egl_display, sync);
+
+			if (fd < 0 || fence_clock_sample(&fence_clock, &fence_reader, fd) == -1) {
+				if (fd >= 0)
+					close(fd);
+				break;
+			}
+			close(fd);
+
+			/* Spread the samples out a bit, to see any drift */
+			nanosleep(&(struct timespec){ .tv_nsec = 2000000 }, NULL);
+		}
+
+		fence_clock_calibrate(&fence_clock);
+	}
+
+	startup_ns[3] = get_time_ns();
+
+	/* GPU timer queries, as a fallback for fences and to check start_ns against */
+	static struct gpu_timer gpu_timer;
+	bool has_gpu_timer = !use_cpu && gpu_timer_init(&gpu_timer);
+
+	if (!use_cpu && target_ms > 0.0 && !egl_has_fences && !has_gpu_timer) {
+		fprintf(stderr, "-t: EGL_ANDROID_native_fence_sync or GL_EXT_disjoint_timer_query: %s\n",
+			strerror(ENOTSUP));
+		return 1;
+	}
+
+	/* Reading back frames, with -c the buffers are checksummed as they are */
+	struct verify *verify = NULL;
+
+	if (!use_cpu && (verify_every > 0 || checksum)) {
+		verify = verify_create(verify_every, verify_tolerance, checksum);
+		if (!verify)
+			return 1;
+	}
+
+	/* The acquire fences are the same ones we time frames with */
+	if (explicit_sync && !egl_has_fences) {
+		fprintf(stderr, "--explicit-sync: EGL_ANDROID_native_fence_sync: %s\n",
+			strerror(ENOTSUP));
+		return 1;
+	}
+
+	/* Timer queries can't be waited for, so the limit needs fences */
+	if (max_inflight > 0 && !egl_has_fences) {
+		fprintf(stderr, "--max-inflight: EGL_ANDROID_native_fence_sync: %s\n",
+			strerror(ENOTSUP));
+		return 1;
+	}
+
+	/*
+	 * Nothing sends frame callbacks with --headless. Unless -u was given,
+	 * wait for each frame's fence instead, if there are fences.
+	 */
+	if (headless) {
+		if (!unsynchronized && max_inflight == 0 && egl_has_fences)
+			max_inflight = 1;
+		unsynchronized = true;
+	}
+
+	/* Closed-loop iteration count */
+	struct iter_control iter_control;
+
+	if (target_ms > 0.0)
+		iter_control_init(&iter_control, target_ms, iter);
+	if (specialize)
+		iter = quantize_iter(iter);
 
 	/* OpenGL */
-	GLuint gl_program;
-	GLuint gl_uniform_frame_num;
-	GLuint gl_uniform_win_size;
+	static struct program_cache gl_programs;
+	const struct program *gl_program = NULL;
 
 	/* Compile GL shaders */
-	{
-		GLuint vert;
-		GLuint frag;
-		GLint status = GL_TRUE;
-
-		vert = compile_shader(vert_src, GL_VERTEX_SHADER, "vert_src");
-		frag = compile_shader(frag_src, GL_FRAGMENT_SHADER, "frag_src");
-
-		gl_program = glCreateProgram();
-		glAttachShader(gl_program, vert);
-		glAttachShader(gl_program, frag);
-		glBindAttribLocation(gl_program, 0, "in_pos");
-		glLinkProgram(gl_program);
-
-		glGetProgramiv(gl_program, GL_LINK_STATUS, &status);
-		if (!status) {
-			char log[1000];
-			GLsizei len;
-			glGetProgramInfoLog(gl_program, sizeof log, &len, log);
-			printf("shader: %s\n", log);
+	if (!use_cpu) {
+		program_cache_init(&gl_programs);
+		gl_program = program_cache_get(&gl_programs,
+			specialize ? iter : 0, specialize ? aa : 0);
+		if (!gl_program)
 			return 1;
-		}
-		glDeleteShader(vert);
-		glDeleteShader(frag);
 	}
 
-	gl_uniform_frame_num = glGetUniformLocation(gl_program, "frame_num");
-	gl_uniform_win_size = glGetUniformLocation(gl_program, "win_size");
+	startup_ns[4] = get_time_ns();
 
 	/* Bind all GL state now, because it will never change */
-	{
+	if (!use_cpu) {
 		static const GLfloat verts[] = {
 			-1.0f, -1.0f,
 			-1.0f, 1.0f,
 			1.0f, 1.0f,
 			1.0f, -1.0f,
 		};
-		GLuint attr_in_pos = glGetAttribLocation(gl_program, "in_pos");
-		GLuint uniform_iter = glGetUniformLocation(gl_program, "iter");
-		GLuint uniform_aa = glGetUniformLocation(gl_program, "aa");
 
-		glUseProgram(gl_program);
+		/* Every program binds in_pos to 0, so this survives switching programs */
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
 
-		glEnableVertexAttribArray(attr_in_pos);
-		glVertexAttribPointer(attr_in_pos, 2, GL_FLOAT, GL_FALSE, 0, verts);
+		glUseProgram(gl_program->program);
+	}
+
+	/* CPU rendering */
+	static struct cpu_frame cpu_frame;
+	struct pool *pool = NULL;
+
+	if (use_cpu) {
+		printf("CPU kernel: %s\n", cpu_init());
 
-		glUniform1i(uniform_iter, iter);
-		glUniform1i(uniform_aa, aa);
+		if (threads > 1) {
+			pool = pool_create(threads);
+			if (!pool)
+				return 1;
+		}
 	}
 
 	/* Main loop */
-	size_t len = 1;
-	size_t cap = 10;
-	struct pollfd *fds;
-	struct { int frame_num; uint64_t start_ns; } *fences;
+	struct frame_set frames;
+	int epoll_fd;
+	bool display_pollout = true;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		perror("epoll_create1");
+		return 1;
+	}
+
+	// wl_display is the only registration with a NULL data.ptr
+	if (wl_display) {
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLOUT,
+			.data.ptr = NULL,
+		};
+
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wl_display_get_fd(wl_display), &ev) == -1) {
+			perror("epoll_ctl");
+			return 1;
+		}
+	}
+
+	if (frame_set_init(&frames, epoll_fd, MAX_FRAMES) == -1)
+		return 1;
+
+	/* Every fence in flight is an open fd */
+	if (egl_has_fences) {
+		struct rlimit lim;
+		if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+			lim.rlim_cur = lim.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &lim);
+		}
+	}
+
+	/* Summary on exit, or on SIGUSR1 */
+	static struct stats stats;
+	stats_init(&stats);
+
+	/* Compositor round trips, in the background */
+	static struct probe probe;
+	if (probe_ms > 0.0 && probe_init(&probe, wl_display, epoll_fd, probe_ms) == -1)
+		return 1;
 
-	fds = calloc(cap, sizeof *fds);
-	fences = calloc(cap, sizeof *fences);
+	/* Submission schedule, if it isn't up to frame callbacks */
+	if ((pacer.mode != PACER_NONE || script_path) && pacer_start(&pacer, epoll_fd) == -1)
+		return 1;
 
-	if (!fds || !fences)
+	/* Per-frame records */
+	struct trace trace = {0};
+	if (trace_path && trace_open(&trace, trace_path) == -1)
 		return 1;
 
-	// fds[0] is always reserved for wl_display
-	fds[0].fd = wl_display_get_fd(wl_display);
-	fds[0].events = POLLIN | POLLOUT;
+	{
+		struct sigaction sa = { .sa_handler = handle_signal };
+		sigemptyset(&sa.sa_mask);
+
+		/* No SA_RESTART, so that epoll_wait returns */
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGUSR1, &sa, NULL);
+	}
+
+	/*
+	 * From here on, only the I/O thread waits on epoll_fd with -T. The
+	 * render thread still adds fences to it. Listeners on the I/O thread
+	 * go by wl_state.io, so it has to be set before the thread starts.
+	 */
+	static struct io_thread io;
+	if (io_threaded) {
+		wl_state.io = &io;
+		if (io_thread_start(&io, wl_display, epoll_fd, probe_ms > 0.0 ? &probe : NULL,
+				pacer.mode != PACER_NONE ? &pacer : NULL) == -1) {
+			wl_state.io = NULL;
+			return 1;
+		}
+	}
 
 	int frame_num = 0;
 	//float color_offset = 0.0f;
 
-	while (!wl_state.close && frame_num < max_frames) {
+	/* With a pacer, each tick hands out frames for every surface instead */
+	bool pacing = pacer.mode != PACER_NONE;
+	uint64_t frames_due = 0;
+
+	/* What a --script phase can change, beyond iter, aa and the size */
+	int active_surfaces = num_surfaces;
+	bool explicit_acquire = explicit_sync;
+	int phase_num = -1;
+	uint64_t phase_end_ns = 0;
+
+	while (!wl_state.close && !quit_requested && frame_num < max_frames) {
+		bool render_error = false;
+		bool frames_full = false;
+		bool rendered = false;
 		int ret;
 
-		/* Render */
+		/* Move on to the next phase of the script, or stop after the last */
+		if (script.len && get_time_ns() >= phase_end_ns) {
+			uint64_t now_ns = get_time_ns();
+
+			if (phase_num >= 0)
+				script.phases[phase_num].end_ns = now_ns;
+			if (++phase_num == (int)script.len)
+				break;
+
+			const struct phase *phase = &script.phases[phase_num];
+			phase_end_ns = now_ns + phase->duration_ns;
+
+			iter = specialize ? quantize_iter(phase->iter) : phase->iter;
+			aa = phase->aa;
+			if (target_ms > 0.0)
+				iter_control_init(&iter_control, target_ms, iter);
 
-		if (unsynchronized || !wl_state.frame) {
+			fixed_size = phase->width > 0;
+			fixed_width = phase->width;
+			fixed_height = phase->height;
+			for (int i = 0; !headless && i < num_surfaces; ++i) {
+				xdg_toplevel_set_max_size(surfaces[i].xdg_toplevel, fixed_width, fixed_height);
+				xdg_toplevel_set_min_size(surfaces[i].xdg_toplevel, fixed_width, fixed_height);
+			}
+
+			unsynchronized = headless || phase_unsynchronized(phase);
+			explicit_acquire = phase_explicit(phase);
+			active_surfaces = phase->surfaces;
+
+			if (pacer_parse(&pacer, phase->pace, phase->pace_arg) == -1 ||
+					pacer_reset(&pacer) == -1)
+				break;
+			pacing = pacer.mode != PACER_NONE;
+			frames_due = 0;
+
+			printf("Phase %d: %f s, iter %d, aa %d, %d surfaces\n", phase_num,
+				(double)phase->duration_ns * 1e-9, phase->iter, phase->aa,
+				phase->surfaces);
+		}
+
+		/* Render every surface whose frame callback has fired */
+
+		for (int s = 0; s < active_surfaces && frame_num < max_frames &&
+				(!pacing || frames_due > 0); ++s) {
+			struct surface *surface = &surfaces[s];
+			struct shm_buffer **shm_slot = NULL;
+
+			if (!unsynchronized && !pacing && surface->frame)
+				continue;
+
+			if (use_cpu) {
+				shm_slot = find_free_buffer(surface->shm_buffers, NUM_SHM_BUFFERS);
+				if (!shm_slot)
+					continue;
+			}
+
+			/*
+			 * Every frame in flight has a slot, so there's a limit. With
+			 * --max-inflight, stop at that many fences too, and block
+			 * below until one of them signals.
+			 */
+			frames_full = frame_set_count(&frames) == frames.cap ||
+				(max_inflight > 0 && frame_set_fences(&frames) >= (size_t)max_inflight);
+			if (frames_full)
+				break;
+
+			struct frame *frame = frame_set_add(&frames);
 			EGLSyncKHR sync;
 			uint64_t start_ns = 0;
 
-			if (!unsynchronized) {
-				wl_state.frame = wl_surface_frame(surface_wl);
-				wl_callback_add_listener(wl_state.frame, &frame_listener, &wl_state);
+			if (!stats.start_ns)
+				stats.start_ns = get_time_ns();
+			if (!surface->stats.start_ns)
+				surface->stats.start_ns = get_time_ns();
+			if (phase_num >= 0 && !script.stats[phase_num].start_ns)
+				script.stats[phase_num].start_ns = get_time_ns();
+
+			/* Paced frames still note down when a callback comes in */
+			if (!unsynchronized && !surface->frame) {
+				surface->frame = wl_surface_frame(surface->frame_surface);
+				surface->frame_record = frame;
+				wl_callback_add_listener(surface->frame, &frame_listener, surface);
+				frame->pending |= FRAME_PENDING_DONE;
+			}
+
+			/* eglSwapBuffers() commits too, so this has to come first */
+			if (wl_state.presentation) {
+				struct wp_presentation_feedback *feedback =
+					wp_presentation_feedback(presentation, surface->frame_surface);
+				wp_presentation_feedback_add_listener(feedback, &feedback_listener, frame);
+				frame->pending |= FRAME_PENDING_PRESENTED;
 			}
 
 			/* Resize window */
 
-			if (wl_state.serial) {
+			if (surface->serial || (fixed_size &&
+					(surface->width != fixed_width || surface->height != fixed_height))) {
 				if (fixed_size) {
-					wl_state.width = fixed_width;
-					wl_state.height = fixed_height;
+					surface->width = fixed_width;
+					surface->height = fixed_height;
 				}
 
-				if (wl_state.width == 0)
-					wl_state.width = 500;
-				if (wl_state.height == 0)
-					wl_state.height = 500;
+				if (surface->width == 0)
+					surface->width = 500;
+				if (surface->height == 0)
+					surface->height = 500;
 
-				wl_egl_window_resize(surface_egl_native, wl_state.width, wl_state.height, 0, 0);
+				if (headless)
+					glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface->width, surface->height,
+						0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+				else if (!use_cpu)
+					wl_egl_window_resize(surface->egl_window, surface->width, surface->height, 0, 0);
 
-				xdg_surface_ack_configure(surface_xdg_base, wl_state.serial);
-				wl_state.serial = 0;
+				if (surface->serial)
+					xdg_surface_ack_configure(surface->xdg_surface, surface->serial);
+				surface->serial = 0;
 			}
 
-			glViewport(0, 0, wl_state.width, wl_state.height);
+			frame->frame_num = frame_num;
+			frame->surface = surface->index;
+			frame->phase = phase_num;
+			frame->iter = iter;
+			frame->aa = aa;
+			frame->width = surface->width;
+			frame->height = surface->height;
+
+			struct camera_pose pose;
+			camera_pose(&camera, frame_num, get_time_ns(), &pose);
+
+			if (use_cpu) {
+				struct shm_buffer *buf = *shm_slot;
+				struct pool_stats pool_stats;
+				uint64_t end_ns;
+
+				if (buf && (buf->width != surface->width || buf->height != surface->height)) {
+					shm_buffer_destroy(buf);
+					buf = NULL;
+				}
+				if (!buf) {
+					buf = shm_buffer_create(wl_state.wl_shm, surface->width, surface->height);
+					if (!buf) {
+						render_error = true;
+						break;
+					}
+					if (render_queue)
+						wl_proxy_set_queue((struct wl_proxy *)buf->wl_buffer, render_queue);
+					*shm_slot = buf;
+				}
+
+				start_ns = get_time_ns();
+				cpu_frame_init(&cpu_frame, &pose, buf->width, buf->height, iter, aa);
+				if (pool)
+					pool_render(pool, &cpu_frame, buf->data, buf->width, &pool_stats);
+				else
+					cpu_render(&cpu_frame, buf->data, buf->width, 0, 0, buf->width, buf->height);
+				end_ns = get_time_ns();
+
+				if (checksum) {
+					frame->checksum = verify_checksum_cpu(buf->data, buf->width,
+						buf->width, buf->height);
+					if (!quiet)
+						print_readback(frame);
+				}
 
-			glUniform2f(gl_uniform_win_size, wl_state.width, wl_state.height);
-			glUniform1i(gl_uniform_frame_num, frame_num);
+				wl_surface_attach(surface->wl_surface, buf->wl_buffer, 0, 0);
+				wl_surface_damage(surface->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+				wl_surface_commit(surface->wl_surface);
+				buf->busy = true;
+
+				frame->start_ns = start_ns;
+				frame->end_ns = end_ns;
+				stats_record_frame(&stats, end_ns - start_ns);
+				stats_record_frame(&surface->stats, end_ns - start_ns);
+				if (phase_num >= 0)
+					stats_record_frame(&script.stats[phase_num], end_ns - start_ns);
+
+				if (quiet) {
+					/* Only the summary */
+				} else if (pool) {
+					printf("Frame %d: %f ms (%d tiles, %d steals, imbalance %.2f)\n",
+						frame_num, (double)(end_ns - start_ns) * 1e-6,
+						pool_stats.tiles, pool_stats.steals,
+						pool_stats_imbalance(&pool_stats, threads));
+				} else if (target_ms > 0.0) {
+					printf("Frame %d: %f ms (iter %d)\n", frame_num,
+						(double)(end_ns - start_ns) * 1e-6, iter);
+				} else {
+					printf("Frame %d: %f ms\n", frame_num,
+						(double)(end_ns - start_ns) * 1e-6);
+				}
 
-			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+				if (target_ms > 0.0)
+					iter = iter_control_update(&iter_control,
+						(double)(end_ns - start_ns) * 1e-6);
+			} else {
+				if (num_surfaces > 1)
+					eglMakeCurrent(egl_display, surface->egl_surface,
+						surface->egl_surface, egl_context);
+
+				glViewport(0, 0, surface->width, surface->height);
+
+				if (specialize && (gl_program->iter != iter || gl_program->aa != aa)) {
+					gl_program = program_cache_get(&gl_programs, iter, aa);
+					if (!gl_program) {
+						render_error = true;
+						break;
+					}
+					glUseProgram(gl_program->program);
+				}
 
-			if (egl_has_fences) {
-				struct timespec ts = {0};
-				sync = egl_create_sync(egl_display, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+				glUniform2f(gl_program->uniform_win_size, surface->width, surface->height);
+				glUniform2f(gl_program->uniform_center, pose.center_x, pose.center_y);
+				glUniform1f(gl_program->uniform_zoom, pose.zoom);
+				glUniform1f(gl_program->uniform_angle, pose.angle);
+				if (gl_program->uniform_iter != -1)
+					glUniform1i(gl_program->uniform_iter, iter);
+				if (gl_program->uniform_aa != -1)
+					glUniform1i(gl_program->uniform_aa, aa);
+
+				bool timed = has_gpu_timer && gpu_timer_begin(&gpu_timer, frame);
+				if (timed)
+					frame->pending |= FRAME_PENDING_QUERY;
+
+				glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+				if (timed)
+					gpu_timer_end(&gpu_timer);
+
+				if (egl_has_fences)
+					sync = egl_create_sync(egl_display, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+				start_ns = get_time_ns();
+				frame->start_ns = start_ns;
+
+				/* Before eglSwapBuffers(), after which the back buffer is gone */
+				if (verify && verify_wants(verify, frame_num)) {
+					struct frame *done;
+
+					while (!verify_read(verify, frame, &pose)) {
+						done = verify_poll(verify, true);
+						if (!done)
+							continue;
+						if (!quiet)
+							print_readback(done);
+						frame_set_clear(&frames, done, FRAME_PENDING_READBACK);
+					}
+					frame->pending |= FRAME_PENDING_READBACK;
+				}
 
 				/*
-				 * TODO: Check if MONOTONIC is guranteed to be the right time domain.
-				 *
-				 * Sampling the clock from userspace might not be the most accurate way
-				 * to do this, but it's good enough for our purposes.
+				 * eglSwapBuffers() commits, so the acquire fence has to be
+				 * set up before. Getting its fd early takes a flush.
 				 */
-				clock_gettime(CLOCK_MONOTONIC, &ts);
-				start_ns = ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
-			}
+				int fd = -1;
+				if (surface->surface_sync && explicit_acquire) {
+					struct zwp_linux_buffer_release_v1 *release;
+
+					glFlush();
+					fd = egl_dup_fence(egl_display, sync);
+					if (fd >= 0)
+						zwp_linux_surface_synchronization_v1_set_acquire_fence(
+							surface->surface_sync, fd);
+
+					release = zwp_linux_surface_synchronization_v1_get_release(
+						surface->surface_sync);
+					zwp_linux_buffer_release_v1_add_listener(release, &release_listener, frame);
+					frame->pending |= FRAME_PENDING_RELEASE;
+				}
 
-			eglSwapBuffers(egl_display, surface_egl);
+				/* Flushing is enough to get at the fence */
+				if (headless)
+					glFlush();
+				else
+					eglSwapBuffers(egl_display, surface->egl_surface);
 
-			if (egl_has_fences) {
-				if (len == cap) {
-					cap *= 2;
-					fds = realloc(fds, sizeof *fds * cap);
-					fences = realloc(fences, sizeof *fences * cap);
+				if (egl_has_fences) {
+					if (fd < 0)
+						fd = egl_dup_fence(egl_display, sync);
 
-					if (!fds || !fences)
-						return 1;
-				}
+					/* Running out of fds only costs us this frame's timing */
+					if (fd >= 0)
+						frame_set_watch_fence(&frames, frame, fd);
 
-				fds[len].fd = egl_dup_fence(egl_display, sync);
-				fds[len].events = POLLIN;
-				//fds[len].revents = 0;
-				fences[len].frame_num = frame_num;
-				fences[len].start_ns = start_ns;
+					egl_destroy_sync(egl_display, sync);
 
-				egl_destroy_sync(egl_display, sync);
-				++len;
+					frame->depth = frame_set_fences(&frames);
+					stats_record_depth(&stats, frame->depth);
+					stats_record_depth(&surface->stats, frame->depth);
+					if (phase_num >= 0)
+						stats_record_depth(&script.stats[phase_num], frame->depth);
+				}
 			}
 
+			frame_set_submit(&frames, frame);
+			rendered = true;
 			++frame_num;
+
+			if (frame_num == 1) {
+				startup_ns[5] = get_time_ns();
+				printf("Startup: connect %f ms, EGL init %f ms, compile/link %f ms, first frame %f ms\n",
+					(double)(startup_ns[1] - startup_ns[0]) * 1e-6,
+					(double)(startup_ns[2] - startup_ns[1]) * 1e-6,
+					(double)(startup_ns[4] - startup_ns[3]) * 1e-6,
+					(double)(startup_ns[5] - startup_ns[4]) * 1e-6);
+				/* Mostly sleeping between samples, so kept out of EGL init */
+				if (egl_has_fences)
+					printf("Startup: fence clock calibration %f ms\n",
+						(double)(startup_ns[3] - startup_ns[2]) * 1e-6);
+			}
 		}
 
-		while (wl_display_prepare_read(wl_display) != 0 && errno == EAGAIN)
-			wl_display_dispatch_pending(wl_display);
+		if (render_error)
+			break;
 
-		errno = 0;
-		do {
-			ret = wl_display_flush(wl_display);
-		} while (ret > 0);
+		if (rendered && frames_due > 0)
+			--frames_due;
 
-		if (ret == -1) {
-			if (errno == EAGAIN) {
-				fds[0].events |= POLLOUT;
-			} else {
+		/* Whether there's nothing to do until something comes in */
+		bool block = pacing ? frames_due == 0 || frames_full :
+			!unsynchronized || frames_full;
+
+		/* Fences which have signalled, from epoll or from the I/O thread */
+		struct frame *signalled[64];
+		int num_signalled = 0;
+
+		if (!io_threaded) {
+			/* With --headless, there's only epoll */
+			if (wl_display) {
+				while (wl_display_prepare_read(wl_display) != 0 && errno == EAGAIN)
+					wl_display_dispatch_pending(wl_display);
+
+				errno = 0;
+				do {
+					ret = wl_display_flush(wl_display);
+				} while (ret > 0);
+
+				if (ret == -1 && errno != EAGAIN) {
+					wl_display_cancel_read(wl_display);
+					break;
+				}
+
+				/* Don't wait for EPOLLOUT if we don't need to. It wakes up epoll too often. */
+				if ((ret == -1) != display_pollout) {
+					struct epoll_event ev = {
+						.events = ret == -1 ? EPOLLIN | EPOLLOUT : EPOLLIN,
+						.data.ptr = NULL,
+					};
+
+					epoll_ctl(epoll_fd, EPOLL_CTL_MOD, wl_display_get_fd(wl_display), &ev);
+					display_pollout = ret == -1;
+				}
+			}
+
+			struct epoll_event events[64];
+			bool display_readable = false;
+			bool display_error = false;
+
+			int timeout = block ? -1 : 0;
+
+			/* A stalled compositor mustn't hold up the rest of the --script */
+			if (block && script.len) {
+				uint64_t now_ns = get_time_ns();
+				uint64_t left_ms = now_ns < phase_end_ns ?
+					(phase_end_ns - now_ns + 999999) / 1000000 : 0;
+				timeout = left_ms < INT_MAX ? (int)left_ms : INT_MAX;
+			}
+
+			ret = epoll_wait(epoll_fd, events, 64, timeout);
+			if (ret == -1 && errno != EINTR) {
+				perror("epoll_wait");
+				if (wl_display)
+					wl_display_cancel_read(wl_display);
+				break;
+			}
+
+			for (int i = 0; i < ret; ++i) {
+				if (!events[i].data.ptr) {
+					display_readable = events[i].events & EPOLLIN;
+					display_error = events[i].events & (EPOLLERR | EPOLLHUP);
+				} else if (events[i].data.ptr == &probe) {
+					probe_tick(&probe);
+				} else if (events[i].data.ptr == &pacer) {
+					frames_due += pacer_tick(&pacer);
+				} else {
+					signalled[num_signalled++] = events[i].data.ptr;
+				}
+			}
+
+			if (display_error) {
 				wl_display_cancel_read(wl_display);
 				break;
 			}
+
+			if (!wl_display) {
+				/* Nothing to read */
+			} else if (display_readable) {
+				wl_display_read_events(wl_display);
+			} else {
+				wl_display_cancel_read(wl_display);
+			}
+			probe_dispatch(&probe);
+			if (wl_display)
+				wl_display_dispatch_pending(wl_display);
 		} else {
-			/* Don't read POLLOUT if we don't need to. It wakes up poll too often. */
-			fds[0].events &= ~POLLOUT;
-		}
+			struct io_event events[64];
+			bool io_error = false;
 
-		ret = poll(fds, len, unsynchronized ? 0 : -1);
-		if (ret == -1 && errno != EINTR) {
-			perror("poll");
-			wl_display_cancel_read(wl_display);
-			break;
-		}
+			ret = io_thread_wait(&io, render_queue, block, events, 64);
+			if (ret == -1)
+				break;
 
-		if (fds[0].revents & (POLLERR | POLLHUP)) {
-			wl_display_cancel_read(wl_display);
-			break;
-		}
+			for (int i = 0; i < ret; ++i) {
+				struct surface *surface = events[i].data;
+
+				if (events[i].type == IO_EVENT_CONFIGURE) {
+					surface->serial = events[i].serial;
+					surface->width = events[i].width;
+					surface->height = events[i].height;
+				} else if (events[i].type == IO_EVENT_CLOSE) {
+					wl_state.close = true;
+				} else if (events[i].type == IO_EVENT_FENCE) {
+					signalled[num_signalled++] = events[i].data;
+				} else if (events[i].type == IO_EVENT_PACE) {
+					frames_due += events[i].count;
+				} else {
+					io_error = true;
+				}
+			}
 
-		wl_display_read_events(wl_display);
-		wl_display_dispatch_pending(wl_display);
+			if (io_error)
+				break;
+		}
 
 		/* Read out rendering times where complete */
 
-		for (size_t i = 1; i < len;) {
+		for (int i = 0; i < num_signalled; ++i) {
+			struct frame *frame = signalled[i];
 			uint64_t end_ns;
 
-			if (!(fds[i].revents & POLLIN)) {
-				++i;
+			if (fence_reader_read(&fence_reader, frame->fd) == -1) {
+				frame_set_clear(&frames, frame, FRAME_PENDING_FENCE);
 				continue;
 			}
+			fence_reader_account(&fence_reader);
+
+			end_ns = fence_clock_to_monotonic(&fence_clock,
+				fence_reader_timestamp(&fence_reader));
+			frame->end_ns = end_ns;
+
+			double frame_ms = (double)(end_ns - frame->start_ns) * 1e-6;
+
+			stats_record_frame(&stats, end_ns - frame->start_ns);
+			stats_record_frame(&surfaces[frame->surface].stats, end_ns - frame->start_ns);
+			if (frame->phase >= 0)
+				stats_record_frame(&script.stats[frame->phase], end_ns - frame->start_ns);
+
+			if (quiet) {
+				/* Only the summary */
+			} else if (target_ms > 0.0) {
+				printf("Frame %d: %f ms (iter %d)\n", frame->frame_num,
+					frame_ms, frame->iter);
+			} else {
+				printf("Frame %d: %f ms\n", frame->frame_num, frame_ms);
+			}
+
+			/* Merged fences, show which one held the frame up */
+			if (!quiet && fence_reader.len > 1) {
+				printf("Frame %d: %" PRIu32 " fences", frame->frame_num, fence_reader.len);
+				for (uint32_t j = 0; j < fence_reader.len; ++j) {
+					const struct sync_fence_info *fence = &fence_reader.fences[j];
+					uint64_t ns = fence_clock_to_monotonic(&fence_clock, fence->timestamp_ns);
+
+					printf(", %.32s/%.32s ", fence->driver_name, fence->obj_name);
+					if (fence->status < 0)
+						printf("error %" PRId32, fence->status);
+					else if (fence->status == 0)
+						printf("unsignalled");
+					else
+						printf("%f ms", ((double)ns - (double)frame->start_ns) * 1e-6);
+				}
+				printf("\n");
+			}
+
+			if (target_ms > 0.0) {
+				iter = iter_control_update(&iter_control, frame_ms);
+				if (specialize)
+					iter = quantize_iter(iter);
+			}
+
+			frame_set_clear(&frames, frame, FRAME_PENDING_FENCE);
+		}
+
+		/* Read out timer queries, where fences are missing or to compare against */
+
+		for (struct frame *frame; has_gpu_timer && (frame = gpu_timer_poll(&gpu_timer));) {
+			double gpu_ms = (double)frame->gpu_time_ns * 1e-6;
+			double start_ms = ((double)frame->gpu_start_ns - (double)frame->start_ns) * 1e-6;
+
+			if (!frame->gpu_time_ns) {
+				/* Lost to a disjoint operation */
+			} else if (egl_has_fences) {
+				if (quiet) {
+					/* Only the summary */
+				} else if (frame->gpu_start_ns) {
+					printf("Frame %d: GPU %f ms, started %f ms after submit\n",
+						frame->frame_num, gpu_ms, start_ms);
+				} else {
+					printf("Frame %d: GPU %f ms\n", frame->frame_num, gpu_ms);
+				}
+			} else {
+				if (frame->gpu_start_ns)
+					frame->end_ns = frame->gpu_start_ns + frame->gpu_time_ns;
+
+				stats_record_frame(&stats, frame->gpu_time_ns);
+				stats_record_frame(&surfaces[frame->surface].stats, frame->gpu_time_ns);
+				if (frame->phase >= 0)
+					stats_record_frame(&script.stats[frame->phase], frame->gpu_time_ns);
+
+				if (quiet) {
+					/* Only the summary */
+				} else if (target_ms > 0.0) {
+					printf("Frame %d: %f ms (iter %d)\n", frame->frame_num,
+						gpu_ms, frame->iter);
+				} else {
+					printf("Frame %d: %f ms\n", frame->frame_num, gpu_ms);
+				}
+
+				if (target_ms > 0.0) {
+					iter = iter_control_update(&iter_control, gpu_ms);
+					if (specialize)
+						iter = quantize_iter(iter);
+				}
+			}
+
+			frame_set_clear(&frames, frame, FRAME_PENDING_QUERY);
+		}
+
+		/* Checksum and compare frames which have been read back */
 
-			end_ns = fence_timestamp(fds[i].fd);
-			close(fds[i].fd);
+		for (struct frame *frame; verify && (frame = verify_poll(verify, false));) {
+			if (!quiet)
+				print_readback(frame);
+			frame_set_clear(&frames, frame, FRAME_PENDING_READBACK);
+		}
+
+		/* Retire frames which aren't waiting for anything anymore */
+		for (struct frame *frame; (frame = frame_set_pop_completed(&frames));) {
+			if (frame->presented_ns) {
+				frame->presented_ns = clock_to_monotonic(wl_state.presentation_clock,
+					frame->presented_ns);
+				stats_record_present(&stats, frame->presented_ns - frame->start_ns);
+				stats_record_present(&surfaces[frame->surface].stats,
+					frame->presented_ns - frame->start_ns);
+				if (frame->phase >= 0)
+					stats_record_present(&script.stats[frame->phase],
+						frame->presented_ns - frame->start_ns);
+			} else if (frame->discarded) {
+				++stats.discarded;
+				++surfaces[frame->surface].stats.discarded;
+				if (frame->phase >= 0)
+					++script.stats[frame->phase].discarded;
+			}
 
-			printf("Frame %d: %f ms\n", fences[i].frame_num,
-				(double)(end_ns - fences[i].start_ns) * 1e-6);
+			if (frame->released_ns) {
+				stats_record_release(&stats, frame->released_ns - frame->start_ns);
+				stats_record_release(&surfaces[frame->surface].stats,
+					frame->released_ns - frame->start_ns);
+				if (frame->phase >= 0)
+					stats_record_release(&script.stats[frame->phase],
+						frame->released_ns - frame->start_ns);
+			}
 
-			for (size_t j = i; j < len - 1; ++j) {
-				fds[j] = fds[j + 1];
-				fences[j] = fences[j + 1];
+			if (quiet || !wl_state.presentation) {
+				/* Nothing to add */
+			} else if (frame->discarded) {
+				printf("Frame %d: discarded\n", frame->frame_num);
+			} else if (frame->end_ns) {
+				printf("Frame %d: submit to render done %f ms, render done to presented %f ms (refresh %f ms, flags 0x%" PRIx32 ")\n",
+					frame->frame_num,
+					(double)(frame->end_ns - frame->start_ns) * 1e-6,
+					((double)frame->presented_ns - (double)frame->end_ns) * 1e-6,
+					(double)frame->refresh_ns * 1e-6, frame->present_flags);
+			} else {
+				printf("Frame %d: submit to presented %f ms (refresh %f ms, flags 0x%" PRIx32 ")\n",
+					frame->frame_num,
+					(double)(frame->presented_ns - frame->start_ns) * 1e-6,
+					(double)frame->refresh_ns * 1e-6, frame->present_flags);
 			}
-			--len;
+
+			trace_frame(&trace, frame);
+			if (clients.index >= 0)
+				clients_report(&clients, frame);
+			frame_set_remove(&frames, frame);
 		}
+
+		if (summary_requested) {
+			summary_requested = 0;
+			probe_collect(&probe, &stats);
+			stats_print(&stats, "Summary", get_time_ns(), stdout);
+			for (int i = 0; num_surfaces > 1 && i < num_surfaces; ++i)
+				print_surface_stats(&surfaces[i], get_time_ns());
+			print_phase_stats(&script, get_time_ns());
+			fence_reader_print(&fence_reader, stdout);
+			pacer_print(&pacer, stdout);
+			if (verify)
+				verify_print(verify, stdout);
+			if (with_victim)
+				victim_print(&victim, stdout);
+			fflush(stdout);
+		}
+	}
+
+	io_thread_stop(&io);
+
+	/* Get the last few frames into the summary */
+	for (struct frame *frame; verify && (frame = verify_poll(verify, true));) {
+		if (!quiet)
+			print_readback(frame);
+	}
+
+	probe_collect(&probe, &stats);
+	stats_print(&stats, "Summary", get_time_ns(), stdout);
+	for (int i = 0; num_surfaces > 1 && i < num_surfaces; ++i)
+		print_surface_stats(&surfaces[i], get_time_ns());
+	print_phase_stats(&script, get_time_ns());
+	fence_reader_print(&fence_reader, stdout);
+	pacer_print(&pacer, stdout);
+	if (verify)
+		verify_print(verify, stdout);
+	if (with_victim)
+		victim_print(&victim, stdout);
+
+
+	trace_close(&trace);
+	if (clients.index >= 0)
+		close(clients.fd);
+	probe_finish(&probe);
+	pacer_finish(&pacer);
+	script_finish(&script);
+	camera_finish(&camera);
+	frame_set_finish(&frames);
+	fence_reader_finish(&fence_reader);
+	close(epoll_fd);
+
+	pool_destroy(pool);
+
+	if (!use_cpu) {
+		verify_destroy(verify);
+		if (has_gpu_timer)
+			gpu_timer_finish(&gpu_timer);
+		program_cache_finish(&gl_programs);
 	}
 
-	if (wl_state.frame)
-		wl_callback_destroy(wl_state.frame);
+	if (headless) {
+		glDeleteFramebuffers(1, &headless_fbo);
+		glDeleteTextures(1, &headless_tex);
+	}
 
-	for (size_t i = 1; i < len; ++i)
-		close(fds[i].fd);
-	free(fds);
-	free(fences);
+	for (int i = 0; !headless && i < num_surfaces; ++i) {
+		struct surface *surface = &surfaces[i];
 
-	glDeleteProgram(gl_program);
+		if (surface->frame)
+			wl_callback_destroy(surface->frame);
+		for (size_t j = 0; j < NUM_SHM_BUFFERS; ++j)
+			shm_buffer_destroy(surface->shm_buffers[j]);
 
-	eglDestroySurface(egl_display, surface_egl);
-	wl_egl_window_destroy(surface_egl_native);
+		if (!use_cpu) {
+			eglDestroySurface(egl_display, surface->egl_surface);
+			wl_egl_window_destroy(surface->egl_window);
+		}
 
-	xdg_toplevel_destroy(surface_xdg_toplevel);
-	xdg_surface_destroy(surface_xdg_base);
-	wl_surface_destroy(surface_wl);
+		xdg_toplevel_destroy(surface->xdg_toplevel);
+		if (surface->surface_sync)
+			zwp_linux_surface_synchronization_v1_destroy(surface->surface_sync);
+		xdg_surface_destroy(surface->xdg_surface);
+		if (surface->frame_surface != surface->wl_surface)
+			wl_proxy_wrapper_destroy(surface->frame_surface);
+		wl_surface_destroy(surface->wl_surface);
+	}
+	free(surfaces);
 
-	eglDestroyContext(egl_display, egl_context);
-	eglTerminate(egl_display);
+	if (with_victim)
+		victim_finish(&victim);
 
-	eglMakeCurrent(NULL, NULL, NULL, NULL);
-	eglReleaseThread();
+	if (!use_cpu) {
+		eglDestroyContext(egl_display, egl_context);
+		eglTerminate(egl_display);
 
-	xdg_wm_base_destroy(wl_state.xdg_wm_base);
-	wl_compositor_destroy(wl_state.wl_compositor);
+		eglMakeCurrent(NULL, NULL, NULL, NULL);
+		eglReleaseThread();
+	}
 
-	wl_display_disconnect(wl_display);
+	/*
+	 * render_queue is left as it is: feedback for frames still in flight
+	 * is attached to it, and goes away with the connection.
+	 */
+	if (presentation != wl_state.presentation)
+		wl_proxy_wrapper_destroy(presentation);
+	if (wl_state.presentation)
+		wp_presentation_destroy(wl_state.presentation);
+	if (wl_state.explicit_sync)
+		zwp_linux_explicit_synchronization_v1_destroy(wl_state.explicit_sync);
+	if (wl_state.wl_shm)
+		wl_shm_destroy(wl_state.wl_shm);
+	if (wl_display) {
+		xdg_wm_base_destroy(wl_state.xdg_wm_base);
+		wl_compositor_destroy(wl_state.wl_compositor);
+
+		wl_display_disconnect(wl_display);
+	}
 }
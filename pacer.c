@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "pacer.h"
+#include "util.h"
+
+static int read_intervals(struct pacer *pacer, const char *path)
+{
+	FILE *f = fopen(path, "re");
+	size_t cap = 0;
+	uint64_t total_ns = 0;
+	char line[128];
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof line, f)) {
+		char *end;
+		double ms = strtod(line, &end);
+
+		/* Blank lines and comments */
+		if (end == line)
+			continue;
+		if (!isfinite(ms) || ms < 0.0 || ms * 1e6 > (double)INT64_MAX) {
+			fprintf(stderr, "%s: invalid interval\n", path);
+			goto error;
+		}
+
+		if (pacer->num_intervals == cap) {
+			cap = cap ? cap * 2 : 256;
+			uint64_t *intervals = realloc(pacer->intervals, cap * sizeof *intervals);
+			if (!intervals) {
+				perror("realloc");
+				goto error;
+			}
+			pacer->intervals = intervals;
+		}
+
+		pacer->intervals[pacer->num_intervals++] = ms * 1e6;
+		total_ns += ms * 1e6;
+	}
+
+	/* The schedule has to move forward, or pacer_tick() never returns */
+	if (total_ns == 0) {
+		fprintf(stderr, "%s: no intervals\n", path);
+		goto error;
+	}
+
+	fclose(f);
+	return 0;
+
+error:
+	fclose(f);
+	free(pacer->intervals);
+	pacer->intervals = NULL;
+	pacer->num_intervals = 0;
+	return -1;
+}
+
+/*
+ * Anything below 1 ns would make pacer_tick() loop forever, as would a
+ * non-finite value, and anything past INT64_MAX doesn't convert.
+ */
+static int to_interval(double ns, uint64_t *interval_ns)
+{
+	if (!isfinite(ns) || ns < 1.0 || ns > (double)INT64_MAX)
+		return -1;
+
+	*interval_ns = ns;
+	return 0;
+}
+
+int pacer_parse(struct pacer *pacer, enum pacer_mode mode, const char *arg)
+{
+	double value;
+
+	/* Only the schedule changes, the timerfd and totals are kept */
+	free(pacer->intervals);
+	*pacer = (struct pacer){
+		.mode = mode,
+		.timer_fd = pacer->timer_fd,
+		.burst = 1,
+		/* Fixed, so that runs can be compared */
+		.rng = UINT64_C(0x9e3779b97f4a7c15),
+		.ticks = pacer->ticks,
+		.late = pacer->late,
+		.frames = pacer->frames,
+	};
+
+	switch (mode) {
+	case PACER_NONE:
+		break;
+	case PACER_FIXED:
+	case PACER_POISSON:
+		value = atof(arg);
+		if (!isfinite(value) || value <= 0.0 ||
+				to_interval(1e9 / value, &pacer->interval_ns) == -1)
+			return -1;
+		pacer->rate = value;
+		break;
+	case PACER_BURST:
+		if (sscanf(arg, "%dx%lf", &pacer->burst, &value) != 2 ||
+				pacer->burst < 1 || to_interval(value * 1e6, &pacer->interval_ns) == -1)
+			return -1;
+		break;
+	case PACER_REPLAY:
+		return read_intervals(pacer, arg);
+	}
+
+	return 0;
+}
+
+/* xorshift64*, uniform in (0, 1] */
+static double next_uniform(struct pacer *pacer)
+{
+	pacer->rng ^= pacer->rng >> 12;
+	pacer->rng ^= pacer->rng << 25;
+	pacer->rng ^= pacer->rng >> 27;
+
+	return ((pacer->rng * UINT64_C(0x2545f4914f6cdd1d) >> 11) + 1) * 0x1.0p-53;
+}
+
+static uint64_t next_interval(struct pacer *pacer)
+{
+	switch (pacer->mode) {
+	case PACER_POISSON:
+		return -log(next_uniform(pacer)) / pacer->rate * 1e9;
+	case PACER_REPLAY: {
+		uint64_t ns = pacer->intervals[pacer->index];
+		pacer->index = (pacer->index + 1) % pacer->num_intervals;
+		return ns;
+	}
+	default:
+		return pacer->interval_ns;
+	}
+}
+
+static int arm(struct pacer *pacer)
+{
+	struct itimerspec its = {
+		.it_value.tv_sec = pacer->next_ns / 1000000000,
+		.it_value.tv_nsec = pacer->next_ns % 1000000000,
+	};
+
+	/* A zero it_value disarms it, which is what PACER_NONE wants */
+	if (pacer->mode == PACER_NONE)
+		its.it_value.tv_sec = its.it_value.tv_nsec = 0;
+	else if (pacer->next_ns == 0)
+		its.it_value.tv_nsec = 1;
+
+	if (timerfd_settime(pacer->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+		perror("timerfd_settime");
+		return -1;
+	}
+
+	return 0;
+}
+
+int pacer_start(struct pacer *pacer, int epoll_fd)
+{
+	pacer->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (pacer->timer_fd == -1) {
+		perror("timerfd_create");
+		return -1;
+	}
+
+	if (pacer_reset(pacer) == -1) {
+		close(pacer->timer_fd);
+		pacer->timer_fd = -1;
+		return -1;
+	}
+
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = pacer,
+	};
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pacer->timer_fd, &ev) == -1) {
+		perror("epoll_ctl");
+		close(pacer->timer_fd);
+		pacer->timer_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+int pacer_reset(struct pacer *pacer)
+{
+	uint64_t expirations;
+
+	/* Anything which fired for the old schedule is dropped */
+	if (read(pacer->timer_fd, &expirations, sizeof expirations) == -1 && errno != EAGAIN)
+		perror("read");
+
+	pacer->next_ns = get_time_ns();
+	return arm(pacer);
+}
+
+void pacer_finish(struct pacer *pacer)
+{
+	if (pacer->timer_fd >= 0)
+		close(pacer->timer_fd);
+	free(pacer->intervals);
+	*pacer = (struct pacer){ .timer_fd = -1 };
+}
+
+uint64_t pacer_tick(struct pacer *pacer)
+{
+	uint64_t expirations;
+	uint64_t now_ns = get_time_ns();
+	uint64_t ticks = 0;
+
+	if (read(pacer->timer_fd, &expirations, sizeof expirations) != sizeof expirations)
+		return 0;
+
+	/* Zero intervals from a replay are due straight away as well */
+	while (pacer->next_ns <= now_ns) {
+		pacer->next_ns += next_interval(pacer);
+		++ticks;
+	}
+
+	if (ticks == 0)
+		return 0;
+
+	pacer->ticks += ticks;
+	pacer->late += ticks - 1;
+	pacer->frames += ticks * pacer->burst;
+
+	arm(pacer);
+	return ticks * pacer->burst;
+}
+
+void pacer_print(const struct pacer *pacer, FILE *f)
+{
+	/* Never started, or only for some --script phases */
+	if (pacer->timer_fd < 0)
+		return;
+
+	fprintf(f, "Pacing: %" PRIu64 " ticks, %" PRIu64 " late, %" PRIu64 " frames due\n",
+		pacer->ticks, pacer->late, pacer->frames);
+}
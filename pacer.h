@@ -0,0 +1,73 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum pacer_mode {
+	PACER_NONE,
+	/* --fps <rate> */
+	PACER_FIXED,
+	/* --burst <n>x<ms>: n frames back to back, every ms */
+	PACER_BURST,
+	/* --poisson <rate>: exponentially distributed intervals */
+	PACER_POISSON,
+	/* --replay <file>: intervals in ms, one per line, repeated */
+	PACER_REPLAY,
+};
+
+/*
+ * Decides when frames get submitted, instead of frame callbacks. Ticks are
+ * scheduled on an absolute CLOCK_MONOTONIC timerfd, so rendering late
+ * doesn't shift the rest of the schedule; ticks which have already passed
+ * by the time the timerfd is read are still handed out, and counted as
+ * late.
+ */
+struct pacer {
+	enum pacer_mode mode;
+	int timer_fd;
+	uint64_t next_ns;
+
+	uint64_t interval_ns;
+	int burst;
+	double rate;
+	uint64_t rng;
+
+	uint64_t *intervals;
+	size_t num_intervals;
+	size_t index;
+
+	/* Written on the I/O thread with -T, and read by pacer_print() */
+	_Atomic uint64_t ticks;
+	_Atomic uint64_t late;
+	_Atomic uint64_t frames;
+};
+
+/*
+ * Parses the option's argument, and reads the file for PACER_REPLAY. Can
+ * be called again to change the schedule, followed by pacer_reset().
+ */
+int pacer_parse(struct pacer *pacer, enum pacer_mode mode, const char *arg);
+
+/*
+ * Registers the timerfd with epoll, with the pacer as its data.ptr, and
+ * schedules the first tick for right now.
+ */
+int pacer_start(struct pacer *pacer, int epoll_fd);
+
+/* Starts the schedule over from now, or stops the timer for PACER_NONE */
+int pacer_reset(struct pacer *pacer);
+
+void pacer_finish(struct pacer *pacer);
+
+/*
+ * Call when the timerfd is readable. Returns how many frames came due,
+ * which after a stall can be a lot of ticks times a large --burst.
+ */
+uint64_t pacer_tick(struct pacer *pacer);
+
+void pacer_print(const struct pacer *pacer, FILE *f);
+
+#endif
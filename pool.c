@@ -0,0 +1,260 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "util.h"
+
+/*
+ * Each worker owns a deque of tile indices. As the tiles of a frame are
+ * known up front, a deque is just a [lo, hi) range packed into one word:
+ * the owner pops from lo, thieves take the upper half with a CAS on the
+ * whole word. Tile indices are never reused within a frame, so there is
+ * no ABA problem.
+ */
+struct worker {
+	_Alignas(64) _Atomic uint64_t range;
+
+	struct pool *pool;
+	pthread_t thread;
+	int id;
+
+	/* Only touched by the owning thread during a frame */
+	uint64_t busy_ns;
+	int tiles;
+	int steals;
+};
+
+struct pool {
+	int threads;
+	struct worker *workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	uint64_t generation;
+	int running;
+	bool quit;
+
+	/* Current frame, valid between start and done */
+	const struct cpu_frame *frame;
+	uint32_t *data;
+	int stride;
+	int tiles_x;
+	int tiles_y;
+};
+
+static inline uint64_t pack_range(uint32_t lo, uint32_t hi)
+{
+	return (uint64_t)hi << 32 | lo;
+}
+
+static int pop_tile(struct worker *w)
+{
+	uint64_t range = atomic_load_explicit(&w->range, memory_order_relaxed);
+
+	for (;;) {
+		uint32_t lo = range;
+		uint32_t hi = range >> 32;
+
+		if (lo >= hi)
+			return -1;
+
+		if (atomic_compare_exchange_weak(&w->range, &range, pack_range(lo + 1, hi)))
+			return lo;
+	}
+}
+
+static int steal_tiles(struct worker *thief)
+{
+	struct pool *pool = thief->pool;
+
+	for (int i = 1; i < pool->threads; ++i) {
+		struct worker *victim = &pool->workers[(thief->id + i) % pool->threads];
+		uint64_t range = atomic_load_explicit(&victim->range, memory_order_relaxed);
+
+		for (;;) {
+			uint32_t lo = range;
+			uint32_t hi = range >> 32;
+
+			if (lo >= hi)
+				break;
+
+			uint32_t mid = hi - (hi - lo + 1) / 2;
+			if (!atomic_compare_exchange_weak(&victim->range, &range, pack_range(lo, mid)))
+				continue;
+
+			/* Our own deque is empty, so no thief will race with this */
+			atomic_store(&thief->range, pack_range(mid + 1, hi));
+			++thief->steals;
+			return mid;
+		}
+	}
+
+	return -1;
+}
+
+static void render_tiles(struct worker *w)
+{
+	struct pool *pool = w->pool;
+	const struct cpu_frame *frame = pool->frame;
+	int tile;
+
+	w->busy_ns = 0;
+	w->tiles = 0;
+	w->steals = 0;
+
+	while ((tile = pop_tile(w)) != -1 || (tile = steal_tiles(w)) != -1) {
+		int x0 = tile % pool->tiles_x * POOL_TILE_SIZE;
+		int y0 = tile / pool->tiles_x * POOL_TILE_SIZE;
+		int x1 = x0 + POOL_TILE_SIZE < frame->width ? x0 + POOL_TILE_SIZE : frame->width;
+		int y1 = y0 + POOL_TILE_SIZE < frame->height ? y0 + POOL_TILE_SIZE : frame->height;
+		uint64_t start_ns = get_time_ns();
+
+		cpu_render(frame, pool->data, pool->stride, x0, y0, x1, y1);
+
+		w->busy_ns += get_time_ns() - start_ns;
+		++w->tiles;
+	}
+}
+
+static void *worker_main(void *data)
+{
+	struct worker *w = data;
+	struct pool *pool = w->pool;
+	uint64_t generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		render_tiles(w);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct pool *pool_create(int threads)
+{
+	struct pool *pool = calloc(1, sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	pool->threads = threads;
+	pool->workers = aligned_alloc(64, sizeof *pool->workers * threads);
+	if (!pool->workers) {
+		free(pool);
+		return NULL;
+	}
+	memset(pool->workers, 0, sizeof *pool->workers * threads);
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (int i = 0; i < threads; ++i) {
+		struct worker *w = &pool->workers[i];
+		w->pool = pool;
+		w->id = i;
+
+		/* Worker 0 is whoever calls pool_render() */
+		if (i == 0)
+			continue;
+
+		int ret = pthread_create(&w->thread, NULL, worker_main, w);
+		if (ret != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+			pool->threads = i;
+			pool_destroy(pool);
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+
+void pool_destroy(struct pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 1; i < pool->threads; ++i)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->workers);
+	free(pool);
+}
+
+void pool_render(struct pool *pool, const struct cpu_frame *frame,
+		uint32_t *data, int stride, struct pool_stats *stats)
+{
+	pool->frame = frame;
+	pool->data = data;
+	pool->stride = stride;
+	pool->tiles_x = (frame->width + POOL_TILE_SIZE - 1) / POOL_TILE_SIZE;
+	pool->tiles_y = (frame->height + POOL_TILE_SIZE - 1) / POOL_TILE_SIZE;
+
+	uint32_t tiles = pool->tiles_x * pool->tiles_y;
+	for (int i = 0; i < pool->threads; ++i) {
+		uint32_t lo = (uint64_t)tiles * i / pool->threads;
+		uint32_t hi = (uint64_t)tiles * (i + 1) / pool->threads;
+		atomic_store(&pool->workers[i].range, pack_range(lo, hi));
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->running = pool->threads - 1;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	render_tiles(&pool->workers[0]);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->running > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!stats)
+		return;
+
+	memset(stats, 0, sizeof *stats);
+	for (int i = 0; i < pool->threads; ++i) {
+		struct worker *w = &pool->workers[i];
+
+		stats->tiles += w->tiles;
+		stats->steals += w->steals;
+		stats->busy_total_ns += w->busy_ns;
+		if (w->busy_ns > stats->busy_max_ns)
+			stats->busy_max_ns = w->busy_ns;
+	}
+}
+
+double pool_stats_imbalance(const struct pool_stats *stats, int threads)
+{
+	if (stats->busy_total_ns == 0)
+		return 1.0;
+
+	return (double)stats->busy_max_ns * threads / stats->busy_total_ns;
+}
@@ -0,0 +1,36 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#define POOL_TILE_SIZE 64
+
+struct pool;
+
+struct pool_stats {
+	int tiles;
+	int steals;
+	/* Time spent rendering tiles, summed over and maxed over the threads */
+	uint64_t busy_total_ns;
+	uint64_t busy_max_ns;
+};
+
+/* Starts threads - 1 workers; the caller of pool_render() is the last one */
+struct pool *pool_create(int threads);
+
+void pool_destroy(struct pool *pool);
+
+/*
+ * Renders a whole frame, split into POOL_TILE_SIZE square tiles. Every
+ * thread starts with an equal run of tiles and steals half of another
+ * thread's remaining run once its own is empty.
+ */
+void pool_render(struct pool *pool, const struct cpu_frame *frame,
+	uint32_t *data, int stride, struct pool_stats *stats);
+
+/* Slowest thread's busy time over the mean, 1.0 is perfectly balanced */
+double pool_stats_imbalance(const struct pool_stats *stats, int threads);
+
+#endif
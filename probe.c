@@ -0,0 +1,146 @@
+#include <math.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "probe.h"
+#include "util.h"
+
+static void sync_done(void *data, struct wl_callback *cb, uint32_t serial)
+{
+	struct probe *probe = data;
+
+	pthread_mutex_lock(&probe->lock);
+	hist_record(&probe->round_trip, get_time_ns() - probe->sent_ns);
+	pthread_mutex_unlock(&probe->lock);
+
+	wl_callback_destroy(probe->callback);
+	probe->callback = NULL;
+}
+
+static const struct wl_callback_listener sync_listener = {
+	.done = sync_done,
+};
+
+int probe_init(struct probe *probe, struct wl_display *wl_display,
+		int epoll_fd, double interval_ms)
+{
+	double interval_ns = interval_ms * 1e6;
+
+	/* Under 1 ns, the timerfd would be disarmed and never fire */
+	if (!isfinite(interval_ns) || interval_ns < 1.0 || interval_ns > (double)INT64_MAX) {
+		fprintf(stderr, "-p: invalid interval\n");
+		return -1;
+	}
+
+	struct itimerspec its = {
+		.it_interval.tv_sec = (uint64_t)interval_ns / 1000000000,
+		.it_interval.tv_nsec = (uint64_t)interval_ns % 1000000000,
+	};
+	its.it_value = its.it_interval;
+
+	*probe = (struct probe){
+		.wl_display = wl_display,
+		.timer_fd = -1,
+	};
+
+	probe->queue = wl_display_create_queue(wl_display);
+	if (!probe->queue) {
+		perror("wl_display_create_queue");
+		return -1;
+	}
+
+	probe->wrapper = wl_proxy_create_wrapper(wl_display);
+	if (!probe->wrapper) {
+		perror("wl_proxy_create_wrapper");
+		goto error;
+	}
+	wl_proxy_set_queue((struct wl_proxy *)probe->wrapper, probe->queue);
+
+	probe->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (probe->timer_fd == -1) {
+		perror("timerfd_create");
+		goto error;
+	}
+
+	if (timerfd_settime(probe->timer_fd, 0, &its, NULL) == -1) {
+		perror("timerfd_settime");
+		goto error;
+	}
+
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = probe,
+	};
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, probe->timer_fd, &ev) == -1) {
+		perror("epoll_ctl");
+		goto error;
+	}
+
+	pthread_mutex_init(&probe->lock, NULL);
+	hist_init(&probe->round_trip);
+
+	return 0;
+
+error:
+	if (probe->timer_fd >= 0)
+		close(probe->timer_fd);
+	if (probe->wrapper)
+		wl_proxy_wrapper_destroy(probe->wrapper);
+	wl_event_queue_destroy(probe->queue);
+	*probe = (struct probe){ .timer_fd = -1 };
+	return -1;
+}
+
+void probe_finish(struct probe *probe)
+{
+	if (!probe->queue)
+		return;
+
+	if (probe->callback)
+		wl_callback_destroy(probe->callback);
+	wl_proxy_wrapper_destroy(probe->wrapper);
+	wl_event_queue_destroy(probe->queue);
+	close(probe->timer_fd);
+	pthread_mutex_destroy(&probe->lock);
+}
+
+void probe_tick(struct probe *probe)
+{
+	uint64_t expirations;
+
+	if (read(probe->timer_fd, &expirations, sizeof expirations) != sizeof expirations)
+		return;
+
+	/* A round trip taking several intervals is what we're looking for */
+	pthread_mutex_lock(&probe->lock);
+	probe->skipped += probe->callback ? expirations : expirations - 1;
+	pthread_mutex_unlock(&probe->lock);
+	if (probe->callback)
+		return;
+
+	probe->callback = wl_display_sync(probe->wrapper);
+	wl_callback_add_listener(probe->callback, &sync_listener, probe);
+	probe->sent_ns = get_time_ns();
+}
+
+void probe_dispatch(struct probe *probe)
+{
+	if (probe->queue)
+		wl_display_dispatch_queue_pending(probe->wl_display, probe->queue);
+}
+
+void probe_collect(struct probe *probe, struct stats *stats)
+{
+	if (!probe->queue)
+		return;
+
+	pthread_mutex_lock(&probe->lock);
+	hist_merge(&stats->round_trip, &probe->round_trip);
+	stats->round_trips_skipped += probe->skipped;
+	hist_init(&probe->round_trip);
+	probe->skipped = 0;
+	pthread_mutex_unlock(&probe->lock);
+}
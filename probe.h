@@ -0,0 +1,55 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+#include "hist.h"
+#include "stats.h"
+
+/*
+ * Measures how quickly the compositor answers, independently of our own
+ * frames: a wl_display.sync is sent every interval, on an event queue of
+ * its own, and its round trip recorded. If the previous one still hasn't
+ * come back, the tick is skipped and counted instead.
+ */
+struct probe {
+	struct wl_display *wl_display;
+	struct wl_event_queue *queue;
+	/* wl_display wrapper whose new objects go on queue */
+	struct wl_display *wrapper;
+	int timer_fd;
+
+	struct wl_callback *callback;
+	uint64_t sent_ns;
+
+	/*
+	 * With -T, ticks and round trips are recorded on the I/O thread, so
+	 * they are kept here under lock until probe_collect().
+	 */
+	pthread_mutex_t lock;
+	struct hist round_trip;
+	uint64_t skipped;
+};
+
+/*
+ * Registers a timerfd firing every interval_ms with epoll, with the probe
+ * as its data.ptr.
+ */
+int probe_init(struct probe *probe, struct wl_display *wl_display,
+	int epoll_fd, double interval_ms);
+
+void probe_finish(struct probe *probe);
+
+/* Call when the timerfd is readable */
+void probe_tick(struct probe *probe);
+
+/* Call after reading events from the display */
+void probe_dispatch(struct probe *probe);
+
+/* Moves everything recorded since the last call into stats */
+void probe_collect(struct probe *probe, struct stats *stats);
+
+#endif
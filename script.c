@@ -0,0 +1,221 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+
+static const struct {
+	const char *name;
+	enum pacer_mode mode;
+} pace_names[] = {
+	{ "fps:", PACER_FIXED },
+	{ "burst:", PACER_BURST },
+	{ "poisson:", PACER_POISSON },
+	{ "replay:", PACER_REPLAY },
+};
+
+static const char *sync_names[] = {
+	[PHASE_SYNC_FRAME] = "frame",
+	[PHASE_SYNC_UNSYNC] = "unsync",
+	[PHASE_SYNC_EXPLICIT] = "explicit",
+	[PHASE_SYNC_EXPLICIT_UNSYNC] = "explicit-unsync",
+};
+
+static int parse_duration(const char *str, uint64_t *ns)
+{
+	char *end;
+	double value = strtod(str, &end);
+	double scale;
+
+	if (end == str)
+		return -1;
+
+	if (strcmp(end, "ms") == 0)
+		scale = 1e6;
+	else if (strcmp(end, "s") == 0)
+		scale = 1e9;
+	else if (strcmp(end, "m") == 0)
+		scale = 60e9;
+	else
+		return -1;
+
+	/* Like the pacer's intervals: nan, inf and 1e30s don't convert */
+	value *= scale;
+	if (!isfinite(value) || value < 1.0 || value > (double)INT64_MAX)
+		return -1;
+
+	*ns = value;
+	return 0;
+}
+
+static int parse_pace(struct phase *phase, const char *value)
+{
+	free(phase->pace_arg);
+	phase->pace_arg = NULL;
+	phase->pace = PACER_NONE;
+
+	if (strcmp(value, "none") == 0)
+		return 0;
+
+	for (size_t i = 0; i < sizeof pace_names / sizeof pace_names[0]; ++i) {
+		size_t len = strlen(pace_names[i].name);
+		if (strncmp(value, pace_names[i].name, len) != 0)
+			continue;
+
+		/* Catch mistakes now rather than halfway through a soak test */
+		struct pacer pacer = { .timer_fd = -1 };
+		int ret = pacer_parse(&pacer, pace_names[i].mode, value + len);
+		pacer_finish(&pacer);
+		if (ret == -1)
+			return -1;
+
+		phase->pace = pace_names[i].mode;
+		phase->pace_arg = strdup(value + len);
+		return phase->pace_arg ? 0 : -1;
+	}
+
+	return -1;
+}
+
+static int parse_setting(struct phase *phase, char *setting)
+{
+	char *value = strchr(setting, '=');
+
+	if (!value)
+		return -1;
+	*value++ = '\0';
+
+	if (strcmp(setting, "iter") == 0) {
+		phase->iter = atoi(value);
+		return phase->iter > 0 ? 0 : -1;
+	} else if (strcmp(setting, "aa") == 0) {
+		phase->aa = atoi(value);
+		return phase->aa > 0 ? 0 : -1;
+	} else if (strcmp(setting, "surfaces") == 0) {
+		phase->surfaces = atoi(value);
+		return phase->surfaces > 0 ? 0 : -1;
+	} else if (strcmp(setting, "size") == 0) {
+		if (strcmp(value, "any") == 0) {
+			phase->width = phase->height = 0;
+			return 0;
+		}
+		if (sscanf(value, "%dx%d", &phase->width, &phase->height) != 2)
+			return -1;
+		return phase->width > 0 && phase->height > 0 ? 0 : -1;
+	} else if (strcmp(setting, "pace") == 0) {
+		return parse_pace(phase, value);
+	} else if (strcmp(setting, "sync") == 0) {
+		for (size_t i = 0; i < sizeof sync_names / sizeof sync_names[0]; ++i) {
+			if (strcmp(value, sync_names[i]) == 0) {
+				phase->sync = i;
+				return 0;
+			}
+		}
+		return -1;
+	}
+
+	return -1;
+}
+
+int script_load(struct script *script, const char *path, const struct phase *defaults)
+{
+	FILE *f = fopen(path, "re");
+	struct phase prev = *defaults;
+	size_t cap = 0;
+	char line[1024];
+	int line_num = 0;
+
+	*script = (struct script){0};
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	prev.pace_arg = defaults->pace_arg ? strdup(defaults->pace_arg) : NULL;
+
+	while (fgets(line, sizeof line, f)) {
+		char *comment = strchr(line, '#');
+		char *save;
+		char *tok;
+
+		++line_num;
+		if (comment)
+			*comment = '\0';
+
+		tok = strtok_r(line, " \t\n", &save);
+		if (!tok)
+			continue;
+
+		struct phase phase = prev;
+		phase.pace_arg = prev.pace_arg ? strdup(prev.pace_arg) : NULL;
+
+		if (parse_duration(tok, &phase.duration_ns) == -1)
+			goto invalid;
+
+		while ((tok = strtok_r(NULL, " \t\n", &save))) {
+			if (parse_setting(&phase, tok) == -1)
+				goto invalid;
+		}
+
+		if (script->len == cap) {
+			cap = cap ? cap * 2 : 16;
+			struct phase *phases = realloc(script->phases, cap * sizeof *phases);
+			if (!phases) {
+				perror("realloc");
+				free(phase.pace_arg);
+				goto error;
+			}
+			script->phases = phases;
+		}
+
+		phase.end_ns = 0;
+		script->phases[script->len++] = phase;
+
+		free(prev.pace_arg);
+		prev = phase;
+		prev.pace_arg = phase.pace_arg ? strdup(phase.pace_arg) : NULL;
+		continue;
+
+invalid:
+		fprintf(stderr, "%s:%d: invalid phase\n", path, line_num);
+		free(phase.pace_arg);
+		goto error;
+	}
+
+	free(prev.pace_arg);
+	fclose(f);
+
+	if (script->len == 0) {
+		fprintf(stderr, "%s: no phases\n", path);
+		script_finish(script);
+		return -1;
+	}
+
+	script->stats = calloc(script->len, sizeof *script->stats);
+	if (!script->stats) {
+		perror("calloc");
+		script_finish(script);
+		return -1;
+	}
+	for (size_t i = 0; i < script->len; ++i)
+		stats_init(&script->stats[i]);
+
+	return 0;
+
+error:
+	free(prev.pace_arg);
+	fclose(f);
+	script_finish(script);
+	return -1;
+}
+
+void script_finish(struct script *script)
+{
+	for (size_t i = 0; i < script->len; ++i)
+		free(script->phases[i].pace_arg);
+	free(script->phases);
+	free(script->stats);
+	*script = (struct script){0};
+}
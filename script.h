@@ -0,0 +1,74 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pacer.h"
+#include "stats.h"
+
+enum phase_sync {
+	/* Wait for frame callbacks, the default */
+	PHASE_SYNC_FRAME,
+	/* As -u */
+	PHASE_SYNC_UNSYNC,
+	/* As --explicit-sync, with or without -u */
+	PHASE_SYNC_EXPLICIT,
+	PHASE_SYNC_EXPLICIT_UNSYNC,
+};
+
+struct phase {
+	uint64_t duration_ns;
+	int iter;
+	int aa;
+	/* Both 0 to leave it up to the compositor */
+	int32_t width;
+	int32_t height;
+	enum pacer_mode pace;
+	/* The pacer option's argument, NULL for PACER_NONE */
+	char *pace_arg;
+	enum phase_sync sync;
+	/* How many of the -n surfaces are drawn */
+	int surfaces;
+
+	/* When the phase was left, 0 until then */
+	uint64_t end_ns;
+};
+
+/*
+ * A --script file has one phase per line, a duration followed by whatever
+ * changes from the phase before:
+ *
+ *   # duration  settings
+ *   10s         iter=500 size=800x600 pace=fps:60
+ *   30s         iter=4000 aa=2 surfaces=4 sync=unsync pace=none
+ *   500ms       size=any
+ *
+ * Durations are in ms, s or m. pace is none or one of fps:, burst:,
+ * poisson: or replay: followed by what the option of that name takes.
+ * sync is frame, unsync, explicit or explicit-unsync. The first phase
+ * starts from what was given on the command line.
+ */
+struct script {
+	struct phase *phases;
+	/* For frames submitted during each phase */
+	struct stats *stats;
+	size_t len;
+};
+
+int script_load(struct script *script, const char *path, const struct phase *defaults);
+
+void script_finish(struct script *script);
+
+static inline bool phase_unsynchronized(const struct phase *phase)
+{
+	return phase->sync == PHASE_SYNC_UNSYNC || phase->sync == PHASE_SYNC_EXPLICIT_UNSYNC;
+}
+
+static inline bool phase_explicit(const struct phase *phase)
+{
+	return phase->sync == PHASE_SYNC_EXPLICIT || phase->sync == PHASE_SYNC_EXPLICIT_UNSYNC;
+}
+
+#endif
@@ -0,0 +1,384 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <EGL/egl.h>
+
+#include "shader.h"
+#include "util.h"
+
+static const GLchar *vert_src =
+"precision highp float;\n"
+"attribute vec2 in_pos;\n"
+"void main() {\n"
+"	gl_Position = vec4(in_pos, 0.0, 1.0);\n"
+"}\n";
+
+/*
+ * https://iquilezles.org/www/articles/mset_smooth/mset_smooth.htm
+ * https://shadertoy.com/view/4df3Rn
+ *
+ * iter and aa may be #defined ahead of this to specialise the shader. The
+ * view comes from a struct camera_pose.
+ */
+static const GLchar *frag_src =
+"precision highp float;\n"
+"uniform vec2 center;\n"
+"uniform float zoom;\n"
+"uniform float angle;\n"
+"#ifndef iter\n"
+"uniform int iter;\n"
+"#endif\n"
+"#ifndef aa\n"
+"uniform int aa;\n"
+"#endif\n"
+"uniform vec2 win_size;\n"
+"void main() {\n"
+"	vec3 col = vec3(0.0, 0.0, 0.0);\n"
+"	float coa = cos(angle);\n"
+"	float sia = sin(angle);\n"
+"	for (int m = 0; m < aa; ++m)\n"
+"	for (int n = 0; n < aa; ++n) {\n"
+"		vec2 p = (-win_size + 2.0 * (gl_FragCoord.xy + vec2(float(m), float(n)) / float(aa))) / win_size.y;\n"
+"		vec2 xy = vec2(p.x * coa - p.y * sia, p.x * sia + p.y * coa);\n"
+"		vec2 c = center + xy * zoom;\n"
+"\n"
+"		const float B = 256.0;\n"
+"		float l = 0.0;\n"
+"		vec2 z = vec2(0.0);\n"
+"		for (int i = 0; i < iter; ++i) {\n"
+"			z = vec2(z.x * z.x - z.y * z.y, 2.0 * z.x * z.y) + c;\n"
+"			if (dot(z, z) > B * B)\n"
+"				break;\n"
+"			l += 1.0;\n"
+"		}\n"
+"\n"
+"		float sl = l - log2(log2(dot(z, z))) + 4.0;\n"
+"		float al = smoothstep(-0.1, 0.0, sin(0.5 * 6.2831));\n"
+"		l = mix(l, sl, al);\n"
+"		col += 0.5 + 0.5 * cos(3.0 + l * 0.15 + vec3(0.0, 0.6, 1.0));\n"
+"	}\n"
+"	col /= float(aa * aa);\n"
+"	gl_FragColor = vec4(col, 1.0);\n"
+"}\n";
+
+/* FNV-1a, including the terminating NUL so concatenations don't collide */
+static uint64_t hash_str(uint64_t hash, const char *str)
+{
+	do {
+		hash ^= (unsigned char)*str;
+		hash *= UINT64_C(0x100000001b3);
+	} while (*str++);
+
+	return hash;
+}
+
+static void format_defines(char *defines, size_t size, int iter, int aa)
+{
+	defines[0] = '\0';
+
+	if (iter)
+		snprintf(defines, size, "#define iter %d\n", iter);
+	if (aa)
+		snprintf(defines + strlen(defines), size - strlen(defines),
+			"#define aa %d\n", aa);
+}
+
+static char *binary_path(const struct program_cache *cache, const char *defines)
+{
+	uint64_t hash = cache->binary_key;
+	hash = hash_str(hash, vert_src);
+	hash = hash_str(hash, defines);
+	hash = hash_str(hash, frag_src);
+
+	size_t len = strlen(cache->binary_dir) + 32;
+	char *path = malloc(len);
+	if (path)
+		snprintf(path, len, "%s/%016" PRIx64 ".bin", cache->binary_dir, hash);
+	return path;
+}
+
+/* Binaries are stored as the GLenum format followed by the blob itself */
+static GLuint load_binary(const struct program_cache *cache, const char *defines)
+{
+	GLuint program = 0;
+	char *path = binary_path(cache, defines);
+	if (!path)
+		return 0;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd == -1)
+		return 0;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size <= (off_t)sizeof(GLenum)) {
+		close(fd);
+		return 0;
+	}
+
+	char *data = malloc(st.st_size);
+	if (!data || read(fd, data, st.st_size) != st.st_size)
+		goto out;
+
+	GLenum format;
+	GLint status = GL_FALSE;
+	memcpy(&format, data, sizeof format);
+
+	program = glCreateProgram();
+	cache->program_binary(program, format, data + sizeof format,
+		st.st_size - sizeof format);
+
+	/* Driver updates make old binaries invalid */
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		glDeleteProgram(program);
+		program = 0;
+	}
+
+out:
+	free(data);
+	close(fd);
+	return program;
+}
+
+static void save_binary(const struct program_cache *cache, const char *defines,
+		GLuint program)
+{
+	GLint len = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &len);
+	if (len <= 0)
+		return;
+
+	char *data = malloc(sizeof(GLenum) + len);
+	char *path = binary_path(cache, defines);
+	char *tmp = path ? malloc(strlen(path) + 32) : NULL;
+	if (!data || !tmp)
+		goto out;
+
+	GLenum format;
+	cache->get_program_binary(program, len, &len, &format, data + sizeof format);
+	memcpy(data, &format, sizeof format);
+
+	/* Write and rename, so concurrent instances never see half a file */
+	sprintf(tmp, "%s.%d", path, (int)getpid());
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		goto out;
+
+	ssize_t size = sizeof format + len;
+	bool ok = write(fd, data, size) == size;
+	close(fd);
+
+	if (!ok || rename(tmp, path) == -1)
+		unlink(tmp);
+
+out:
+	free(tmp);
+	free(path);
+	free(data);
+}
+
+static GLuint compile_shader(const GLchar *defines, const GLchar *src,
+		GLenum type, const char *tag)
+{
+	const GLchar *srcs[] = { defines, src };
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 2, srcs, NULL);
+	glCompileShader(shader);
+
+	GLint status = GL_TRUE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		char log[1000];
+		GLsizei len;
+		glGetShaderInfoLog(shader, sizeof log, &len, log);
+		fprintf(stderr, "%s: %s\n", tag, log);
+
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+static GLuint link_program(const char *defines)
+{
+	GLuint vert;
+	GLuint frag;
+	GLuint program;
+	GLint status = GL_TRUE;
+
+	vert = compile_shader("", vert_src, GL_VERTEX_SHADER, "vert_src");
+	frag = compile_shader(defines, frag_src, GL_FRAGMENT_SHADER, "frag_src");
+	if (!vert || !frag) {
+		glDeleteShader(vert);
+		glDeleteShader(frag);
+		return 0;
+	}
+
+	program = glCreateProgram();
+	glAttachShader(program, vert);
+	glAttachShader(program, frag);
+	glBindAttribLocation(program, 0, "in_pos");
+	glLinkProgram(program);
+
+	glDeleteShader(vert);
+	glDeleteShader(frag);
+
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		char log[1000];
+		GLsizei len;
+		glGetProgramInfoLog(program, sizeof log, &len, log);
+		printf("shader: %s\n", log);
+
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
+const struct program *program_cache_get(struct program_cache *cache, int iter, int aa)
+{
+	struct program *lru = &cache->programs[0];
+
+	++cache->clock;
+
+	for (size_t i = 0; i < PROGRAM_CACHE_SIZE; ++i) {
+		struct program *p = &cache->programs[i];
+
+		if (p->program && p->iter == iter && p->aa == aa) {
+			p->last_used = cache->clock;
+			return p;
+		}
+
+		/* Empty slots have never been used, so they're picked first */
+		if (p->last_used < lru->last_used)
+			lru = p;
+	}
+
+	if (lru->program)
+		glDeleteProgram(lru->program);
+	memset(lru, 0, sizeof *lru);
+
+	char defines[64];
+	format_defines(defines, sizeof defines, iter, aa);
+
+	uint64_t start_ns = get_time_ns();
+	GLuint program = 0;
+	bool cached = false;
+
+	if (cache->binary_dir) {
+		program = load_binary(cache, defines);
+		cached = program != 0;
+	}
+	if (!program) {
+		program = link_program(defines);
+		if (!program)
+			return NULL;
+		if (cache->binary_dir)
+			save_binary(cache, defines, program);
+	}
+	double compile_ms = (double)(get_time_ns() - start_ns) * 1e-6;
+
+	lru->program = program;
+	lru->iter = iter;
+	lru->aa = aa;
+	lru->last_used = cache->clock;
+	lru->uniform_center = glGetUniformLocation(program, "center");
+	lru->uniform_zoom = glGetUniformLocation(program, "zoom");
+	lru->uniform_angle = glGetUniformLocation(program, "angle");
+	lru->uniform_win_size = glGetUniformLocation(program, "win_size");
+	lru->uniform_iter = glGetUniformLocation(program, "iter");
+	lru->uniform_aa = glGetUniformLocation(program, "aa");
+
+	if (iter || aa)
+		printf("Program iter=%d aa=%d: %s in %f ms\n", iter, aa,
+			cached ? "loaded" : "compiled", compile_ms);
+	else
+		printf("Program: %s in %f ms\n", cached ? "loaded" : "compiled", compile_ms);
+
+	return lru;
+}
+
+static int mkdir_p(char *path)
+{
+	for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		int ret = mkdir(path, 0755);
+		*p = '/';
+		if (ret == -1 && errno != EEXIST)
+			return -1;
+	}
+
+	if (mkdir(path, 0755) == -1 && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+void program_cache_init(struct program_cache *cache)
+{
+	const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+	if (!exts || !has_ext(exts, "GL_OES_get_program_binary"))
+		return;
+
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+	if (formats <= 0)
+		return;
+
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *suffix = "/compositor-killer";
+	if (!base || base[0] != '/') {
+		base = getenv("HOME");
+		suffix = "/.cache/compositor-killer";
+		if (!base)
+			return;
+	}
+
+	char *dir = malloc(strlen(base) + strlen(suffix) + 1);
+	if (!dir)
+		return;
+	sprintf(dir, "%s%s", base, suffix);
+
+	if (mkdir_p(dir) == -1) {
+		free(dir);
+		return;
+	}
+
+	/* Binaries are only valid for the driver that produced them */
+	const char *renderer = (const char *)glGetString(GL_RENDERER);
+	const char *version = (const char *)glGetString(GL_VERSION);
+	uint64_t key = UINT64_C(0xcbf29ce484222325);
+	key = hash_str(key, renderer ? renderer : "");
+	key = hash_str(key, version ? version : "");
+
+	cache->binary_dir = dir;
+	cache->binary_key = key;
+	cache->get_program_binary = (void *)eglGetProcAddress("glGetProgramBinaryOES");
+	cache->program_binary = (void *)eglGetProcAddress("glProgramBinaryOES");
+
+	if (!cache->get_program_binary || !cache->program_binary) {
+		free(cache->binary_dir);
+		cache->binary_dir = NULL;
+	}
+}
+
+void program_cache_finish(struct program_cache *cache)
+{
+	for (size_t i = 0; i < PROGRAM_CACHE_SIZE; ++i) {
+		if (cache->programs[i].program)
+			glDeleteProgram(cache->programs[i].program);
+	}
+
+	free(cache->binary_dir);
+	memset(cache, 0, sizeof *cache);
+}
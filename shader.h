@@ -0,0 +1,59 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <stdint.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#define PROGRAM_CACHE_SIZE 16
+
+struct program {
+	GLuint program;
+	GLint uniform_center;
+	GLint uniform_zoom;
+	GLint uniform_angle;
+	GLint uniform_win_size;
+	/* -1 when the value is baked into the program */
+	GLint uniform_iter;
+	GLint uniform_aa;
+
+	/* Baked in values, or 0 if they are read from uniforms */
+	int iter;
+	int aa;
+	uint64_t last_used;
+};
+
+/*
+ * Linked programs, keyed by their baked in (iter, aa). The least recently
+ * used one is thrown away once the cache is full.
+ */
+struct program_cache {
+	struct program programs[PROGRAM_CACHE_SIZE];
+	uint64_t clock;
+
+	/*
+	 * Linked program binaries are also kept on disk, if the driver supports
+	 * GL_OES_get_program_binary. binary_dir is NULL otherwise.
+	 */
+	char *binary_dir;
+	uint64_t binary_key;
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+};
+
+/*
+ * Sets up the on-disk cache under $XDG_CACHE_HOME. Needs a current context.
+ * Failing that just means every program gets compiled from source.
+ */
+void program_cache_init(struct program_cache *cache);
+
+/*
+ * Returns a program with iter and aa compiled in as constants, or read from
+ * uniforms if they are 0. Returns NULL if compiling or linking fails.
+ */
+const struct program *program_cache_get(struct program_cache *cache, int iter, int aa);
+
+void program_cache_finish(struct program_cache *cache);
+
+#endif
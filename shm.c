@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "shm.h"
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct shm_buffer *buf = data;
+	buf->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = buffer_release,
+};
+
+struct shm_buffer *shm_buffer_create(struct wl_shm *shm, int32_t width, int32_t height)
+{
+	struct shm_buffer *buf = calloc(1, sizeof *buf);
+	if (!buf)
+		return NULL;
+
+	buf->width = width;
+	buf->height = height;
+	buf->size = (size_t)width * height * 4;
+
+	int fd = memfd_create("compositor-killer", MFD_CLOEXEC);
+	if (fd == -1) {
+		perror("memfd_create");
+		goto error_buf;
+	}
+
+	if (ftruncate(fd, buf->size) == -1) {
+		perror("ftruncate");
+		goto error_fd;
+	}
+
+	buf->data = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buf->data == MAP_FAILED) {
+		perror("mmap");
+		goto error_fd;
+	}
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, buf->size);
+	buf->wl_buffer = wl_shm_pool_create_buffer(pool, 0, width, height,
+		width * 4, WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	wl_buffer_add_listener(buf->wl_buffer, &buffer_listener, buf);
+
+	return buf;
+
+error_fd:
+	close(fd);
+error_buf:
+	free(buf);
+	return NULL;
+}
+
+void shm_buffer_destroy(struct shm_buffer *buf)
+{
+	if (!buf)
+		return;
+
+	wl_buffer_destroy(buf->wl_buffer);
+	munmap(buf->data, buf->size);
+	free(buf);
+}
@@ -0,0 +1,24 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+struct shm_buffer {
+	struct wl_buffer *wl_buffer;
+	uint32_t *data;
+	size_t size;
+	int32_t width;
+	int32_t height;
+	/* Attached to a surface and not released by the compositor yet */
+	bool busy;
+};
+
+/* Creates an XRGB8888 buffer with a stride of width pixels */
+struct shm_buffer *shm_buffer_create(struct wl_shm *shm, int32_t width, int32_t height);
+
+void shm_buffer_destroy(struct shm_buffer *buf);
+
+#endif
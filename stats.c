@@ -0,0 +1,76 @@
+#include <inttypes.h>
+
+#include "stats.h"
+
+void stats_init(struct stats *stats)
+{
+	stats->start_ns = 0;
+	stats->frames = 0;
+	hist_init(&stats->frame_time);
+	stats->presented = 0;
+	stats->discarded = 0;
+	hist_init(&stats->present_latency);
+	hist_init(&stats->release_latency);
+	hist_init(&stats->depth);
+	hist_init(&stats->round_trip);
+	stats->round_trips_skipped = 0;
+}
+
+void stats_record_frame(struct stats *stats, uint64_t duration_ns)
+{
+	++stats->frames;
+	hist_record(&stats->frame_time, duration_ns);
+}
+
+void stats_record_present(struct stats *stats, uint64_t latency_ns)
+{
+	++stats->presented;
+	hist_record(&stats->present_latency, latency_ns);
+}
+
+void stats_record_release(struct stats *stats, uint64_t latency_ns)
+{
+	hist_record(&stats->release_latency, latency_ns);
+}
+
+void stats_record_depth(struct stats *stats, uint32_t depth)
+{
+	hist_record(&stats->depth, depth);
+}
+
+void stats_record_round_trip(struct stats *stats, uint64_t duration_ns)
+{
+	hist_record(&stats->round_trip, duration_ns);
+}
+
+void stats_print(const struct stats *stats, const char *name, uint64_t now_ns, FILE *f)
+{
+	double elapsed = stats->start_ns ? (double)(now_ns - stats->start_ns) * 1e-9 : 0.0;
+
+	fprintf(f, "%s: %" PRIu64 " frames in %.3f s, %.2f frames/s\n",
+		name, stats->frames, elapsed, elapsed > 0.0 ? stats->frames / elapsed : 0.0);
+	hist_print(&stats->frame_time, "Frame time", f);
+
+	if (stats->presented || stats->discarded) {
+		fprintf(f, "Presentation: %" PRIu64 " presented, %" PRIu64 " discarded\n",
+			stats->presented, stats->discarded);
+		hist_print(&stats->present_latency, "Present latency", f);
+	}
+
+	if (stats->release_latency.count)
+		hist_print(&stats->release_latency, "Buffer release", f);
+
+	/* hist_print() assumes nanoseconds */
+	if (stats->depth.count) {
+		fprintf(f, "Queue depth: mean %.2f, p50 %" PRIu64 ", p99 %" PRIu64 ", max %" PRIu64 "\n",
+			stats->depth.sum / stats->depth.count,
+			hist_percentile(&stats->depth, 0.5),
+			hist_percentile(&stats->depth, 0.99), stats->depth.max);
+	}
+
+	if (stats->round_trip.count || stats->round_trips_skipped) {
+		hist_print(&stats->round_trip, "Compositor round trip", f);
+		fprintf(f, "Compositor round trip: %" PRIu64 " probes skipped while one was outstanding\n",
+			stats->round_trips_skipped);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hist.h"
+
+struct stats {
+	/* When the first frame was submitted */
+	uint64_t start_ns;
+	/* Frames whose rendering has completed */
+	uint64_t frames;
+
+	struct hist frame_time;
+
+	/* wp_presentation feedback, latency is from submission */
+	uint64_t presented;
+	uint64_t discarded;
+	struct hist present_latency;
+
+	/* --explicit-sync buffer releases, latency is from submission */
+	struct hist release_latency;
+
+	/* Fences outstanding at each submission, as a plain count */
+	struct hist depth;
+
+	/* wl_display.sync round trips, see struct probe */
+	struct hist round_trip;
+	uint64_t round_trips_skipped;
+};
+
+void stats_init(struct stats *stats);
+
+void stats_record_frame(struct stats *stats, uint64_t duration_ns);
+
+void stats_record_present(struct stats *stats, uint64_t latency_ns);
+
+void stats_record_release(struct stats *stats, uint64_t latency_ns);
+
+void stats_record_depth(struct stats *stats, uint32_t depth);
+
+void stats_record_round_trip(struct stats *stats, uint64_t duration_ns);
+
+/* Prints percentiles and throughput up to now_ns, headed by name */
+void stats_print(const struct stats *stats, const char *name, uint64_t now_ns, FILE *f);
+
+#endif
@@ -0,0 +1,312 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#include "syncfile.h"
+
+/* A fence signalling this long before we wake up isn't in the clock we think */
+#define MAX_WAKE_LATENCY_NS 10000000
+
+static const clockid_t candidates[FENCE_CLOCK_CANDIDATES] = {
+	CLOCK_MONOTONIC,
+	CLOCK_MONOTONIC_RAW,
+	CLOCK_BOOTTIME,
+};
+
+static const char *const candidate_names[FENCE_CLOCK_CANDIDATES] = {
+	"MONOTONIC",
+	"MONOTONIC_RAW",
+	"BOOTTIME",
+};
+
+void fence_reader_finish(struct fence_reader *reader)
+{
+	free(reader->fences);
+	*reader = (struct fence_reader){0};
+}
+
+int fence_reader_read(struct fence_reader *reader, int fd)
+{
+	struct sync_file_info file = {0};
+
+	reader->len = 0;
+
+	/* With num_fences at 0, this only tells us how many there are */
+	if (ioctl(fd, SYNC_IOC_FILE_INFO, &file) == -1) {
+		perror("SYNC_IOC_FILE_INFO");
+		return -1;
+	}
+
+	if (file.num_fences > reader->cap) {
+		struct sync_fence_info *fences =
+			realloc(reader->fences, sizeof *fences * file.num_fences);
+		if (!fences) {
+			perror("realloc");
+			return -1;
+		}
+
+		reader->fences = fences;
+		reader->cap = file.num_fences;
+	}
+
+	file.sync_fence_info = (__u64)(uintptr_t)reader->fences;
+
+	if (ioctl(fd, SYNC_IOC_FILE_INFO, &file) == -1) {
+		perror("SYNC_IOC_FILE_INFO");
+		return -1;
+	}
+
+	reader->len = file.num_fences;
+	return 0;
+}
+
+int fence_reader_latest(const struct fence_reader *reader)
+{
+	int latest = -1;
+
+	for (uint32_t i = 0; i < reader->len; ++i) {
+		if (latest == -1 || reader->fences[i].timestamp_ns > reader->fences[latest].timestamp_ns)
+			latest = i;
+	}
+
+	return latest;
+}
+
+static struct fence_timeline *find_timeline(struct fence_reader *reader,
+		const struct sync_fence_info *fence)
+{
+	for (int i = 0; i < reader->num_timelines; ++i) {
+		struct fence_timeline *t = &reader->timelines[i];
+
+		if (strncmp(t->driver_name, fence->driver_name, sizeof t->driver_name) == 0 &&
+				strncmp(t->obj_name, fence->obj_name, sizeof t->obj_name) == 0)
+			return t;
+	}
+
+	if (reader->num_timelines == FENCE_TIMELINES)
+		return NULL;
+
+	struct fence_timeline *t = &reader->timelines[reader->num_timelines++];
+	*t = (struct fence_timeline){0};
+	memcpy(t->driver_name, fence->driver_name, sizeof t->driver_name);
+	memcpy(t->obj_name, fence->obj_name, sizeof t->obj_name);
+	t->driver_name[sizeof t->driver_name - 1] = '\0';
+	t->obj_name[sizeof t->obj_name - 1] = '\0';
+
+	return t;
+}
+
+void fence_reader_account(struct fence_reader *reader)
+{
+	int latest = fence_reader_latest(reader);
+
+	for (uint32_t i = 0; i < reader->len; ++i) {
+		struct fence_timeline *t = find_timeline(reader, &reader->fences[i]);
+		if (!t)
+			continue;
+
+		++t->fences;
+		if ((int)i == latest)
+			++t->latest;
+		if (reader->fences[i].status < 0)
+			++t->errors;
+	}
+}
+
+void fence_reader_print(const struct fence_reader *reader, FILE *f)
+{
+	for (int i = 0; i < reader->num_timelines; ++i) {
+		const struct fence_timeline *t = &reader->timelines[i];
+
+		fprintf(f, "Fence timeline %s/%s: %" PRIu64 " fences, %" PRIu64 " signalled last, %" PRIu64 " errors\n",
+			t->driver_name, t->obj_name, t->fences, t->latest, t->errors);
+	}
+}
+
+static uint64_t read_clock(clockid_t clock)
+{
+	struct timespec ts = {0};
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+void fence_clock_init(struct fence_clock *fc)
+{
+	*fc = (struct fence_clock){ .clock = CLOCK_MONOTONIC };
+}
+
+int fence_clock_sample(struct fence_clock *fc, struct fence_reader *reader, int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	if (fc->samples == FENCE_CLOCK_SAMPLES)
+		return 0;
+
+	if (poll(&pfd, 1, 1000) != 1)
+		return -1;
+
+	uint64_t *wake_ns = fc->wake_ns[fc->samples];
+	for (int i = 0; i < FENCE_CLOCK_CANDIDATES; ++i)
+		wake_ns[i] = read_clock(candidates[i]);
+
+	if (fence_reader_read(reader, fd) == -1)
+		return 0;
+
+	fc->signal_ns[fc->samples] = fence_reader_timestamp(reader);
+	if (fc->signal_ns[fc->samples])
+		++fc->samples;
+
+	return 0;
+}
+
+/*
+ * Offset and drift of the given clock against CLOCK_MONOTONIC. Both are
+ * read back to back at every sample, so this is much more precise than
+ * anything involving the fence timestamps themselves.
+ */
+static void against_monotonic(struct fence_clock *fc, int c)
+{
+	const uint64_t *first = fc->wake_ns[0];
+	const uint64_t *last = fc->wake_ns[fc->samples - 1];
+	int64_t first_offset = (int64_t)(first[0] - first[c]);
+	int64_t last_offset = (int64_t)(last[0] - last[c]);
+
+	fc->base_ns = first[c];
+	fc->offset_ns = first_offset;
+	if (last[c] != first[c])
+		fc->drift = (double)(last_offset - first_offset) / (double)(last[c] - first[c]);
+}
+
+/*
+ * For a clock we can't read ourselves, fit a line to when each fence was
+ * seen against its timestamp. Waking up always comes after signalling, so
+ * the line is then lowered to the earliest wakeup.
+ */
+static void fit_unknown(struct fence_clock *fc)
+{
+	double mean_x = 0.0;
+	double mean_y = 0.0;
+	double sxx = 0.0;
+	double sxy = 0.0;
+
+	fc->base_ns = fc->signal_ns[0];
+
+	for (int i = 0; i < fc->samples; ++i) {
+		mean_x += (double)(int64_t)(fc->signal_ns[i] - fc->base_ns);
+		mean_y += (double)(int64_t)(fc->wake_ns[i][0] - fc->signal_ns[i]);
+	}
+	mean_x /= fc->samples;
+	mean_y /= fc->samples;
+
+	for (int i = 0; i < fc->samples; ++i) {
+		double x = (double)(int64_t)(fc->signal_ns[i] - fc->base_ns) - mean_x;
+		double y = (double)(int64_t)(fc->wake_ns[i][0] - fc->signal_ns[i]) - mean_y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	fc->drift = sxx > 0.0 ? sxy / sxx : 0.0;
+
+	fc->offset_ns = INT64_MAX;
+	for (int i = 0; i < fc->samples; ++i) {
+		double x = (double)(int64_t)(fc->signal_ns[i] - fc->base_ns);
+		int64_t offset = (int64_t)(fc->wake_ns[i][0] - fc->signal_ns[i]) -
+			(int64_t)(x * fc->drift);
+		if (offset < fc->offset_ns)
+			fc->offset_ns = offset;
+	}
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Wakeup latencies of every sample if fences were in clock c, as the
+ * earliest one and the median. For the right clock, the earliest is just
+ * above 0 and the rest aren't much later. The median leaves out the odd
+ * wakeup that got held up.
+ */
+static void wake_latency(const struct fence_clock *fc, int c, int64_t *min, int64_t *median)
+{
+	int64_t latency[FENCE_CLOCK_SAMPLES];
+
+	for (int i = 0; i < fc->samples; ++i)
+		latency[i] = (int64_t)(fc->wake_ns[i][c] - fc->signal_ns[i]);
+	qsort(latency, fc->samples, sizeof latency[0], compare_latency);
+
+	*min = latency[0];
+	*median = latency[fc->samples / 2];
+}
+
+static bool latency_plausible(int64_t min, int64_t median)
+{
+	return min >= 0 && median <= MAX_WAKE_LATENCY_NS;
+}
+
+void fence_clock_calibrate(struct fence_clock *fc)
+{
+	int64_t latency[FENCE_CLOCK_CANDIDATES];
+	int64_t median[FENCE_CLOCK_CANDIDATES];
+	int best = -1;
+
+	if (fc->samples < 2) {
+		fprintf(stderr, "Fence clock: not enough samples, assuming MONOTONIC\n");
+		fence_clock_init(fc);
+		return;
+	}
+
+	for (int c = 0; c < FENCE_CLOCK_CANDIDATES; ++c)
+		wake_latency(fc, c, &latency[c], &median[c]);
+
+	/*
+	 * MONOTONIC is what every driver uses, so it is kept unless it is
+	 * clearly wrong, i.e. fences signalled after we woke up or long
+	 * before. A clock just behind it, like MONOTONIC_RAW, can easily
+	 * look closer. Otherwise, the right clock is the one whose offset
+	 * to the fences stays the most consistent.
+	 */
+	if (latency_plausible(latency[0], median[0])) {
+		best = 0;
+	} else {
+		for (int c = 1; c < FENCE_CLOCK_CANDIDATES; ++c) {
+			if (!latency_plausible(latency[c], median[c]))
+				continue;
+			if (best == -1 || median[c] - latency[c] < median[best] - latency[best])
+				best = c;
+		}
+	}
+
+	fc->offset_ns = 0;
+	fc->drift = 0.0;
+
+	if (best == 0) {
+		fc->clock = CLOCK_MONOTONIC;
+		fc->base_ns = 0;
+	} else if (best > 0) {
+		fc->clock = candidates[best];
+		against_monotonic(fc, best);
+	} else {
+		fc->clock = -1;
+		fit_unknown(fc);
+	}
+
+	if (best >= 0) {
+		printf("Fence clock: %s, offset %" PRId64 " ns, drift %.1f ppm, wakeup latency %f ms (%d samples)\n",
+			candidate_names[best], fc->offset_ns, fc->drift * 1e6,
+			(double)latency[best] * 1e-6, fc->samples);
+	} else {
+		fprintf(stderr, "Fence clock: unknown, fitted offset %" PRId64 " ns, drift %.1f ppm (%d samples)\n",
+			fc->offset_ns, fc->drift * 1e6, fc->samples);
+	}
+}
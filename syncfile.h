@@ -0,0 +1,104 @@
+#ifndef SYNCFILE_H
+#define SYNCFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <linux/sync_file.h>
+
+/* Fences waited for by fence_clock_sample() */
+#define FENCE_CLOCK_SAMPLES 32
+
+/* Clocks sync_file timestamps are checked against */
+#define FENCE_CLOCK_CANDIDATES 3
+
+/*
+ * The kernel doesn't say which clock sync_fence_info.timestamp_ns is in.
+ * It is CLOCK_MONOTONIC on every driver we know of, but everything else we
+ * time is, so this is checked at startup by waiting for some fences and
+ * looking at which clock they were signalled just before.
+ */
+struct fence_clock {
+	int samples;
+	uint64_t signal_ns[FENCE_CLOCK_SAMPLES];
+	/* Read right after each fence signalled, one per candidate clock */
+	uint64_t wake_ns[FENCE_CLOCK_SAMPLES][FENCE_CLOCK_CANDIDATES];
+
+	/* The matching clock, or -1 if none did */
+	clockid_t clock;
+	/* CLOCK_MONOTONIC = ts + offset_ns + (ts - base_ns) * drift */
+	uint64_t base_ns;
+	int64_t offset_ns;
+	double drift;
+};
+
+/* Distinct (driver, timeline) pairs tracked, any others aren't counted */
+#define FENCE_TIMELINES 16
+
+struct fence_timeline {
+	char driver_name[32];
+	char obj_name[32];
+	uint64_t fences;
+	/* How often it signalled last out of all fences in its sync_file */
+	uint64_t latest;
+	uint64_t errors;
+};
+
+/*
+ * Reads the fences making up a sync_file, which may be more than one once
+ * fences get merged. The buffer is reused, and only ever grows to the
+ * largest sync_file seen.
+ */
+struct fence_reader {
+	struct sync_fence_info *fences;
+	uint32_t len;
+	uint32_t cap;
+
+	struct fence_timeline timelines[FENCE_TIMELINES];
+	int num_timelines;
+};
+
+void fence_reader_finish(struct fence_reader *reader);
+
+/* Returns -1 on error, leaving no fences */
+int fence_reader_read(struct fence_reader *reader, int fd);
+
+/* Index of the fence which signalled last, or -1 if there are none */
+int fence_reader_latest(const struct fence_reader *reader);
+
+/* Latest signal timestamp of the fences just read, or 0 */
+static inline uint64_t fence_reader_timestamp(const struct fence_reader *reader)
+{
+	int i = fence_reader_latest(reader);
+	return i >= 0 ? reader->fences[i].timestamp_ns : 0;
+}
+
+/* Counts the fences just read towards their timelines */
+void fence_reader_account(struct fence_reader *reader);
+
+/* Prints the per-timeline counts, if any */
+void fence_reader_print(const struct fence_reader *reader, FILE *f);
+
+/* Starts out assuming CLOCK_MONOTONIC */
+void fence_clock_init(struct fence_clock *fc);
+
+/*
+ * Waits for fd to signal and records a calibration sample. Returns -1 if it
+ * didn't signal within a second.
+ */
+int fence_clock_sample(struct fence_clock *fc, struct fence_reader *reader, int fd);
+
+/* Works out the clock, offset and drift, and prints them */
+void fence_clock_calibrate(struct fence_clock *fc);
+
+static inline uint64_t fence_clock_to_monotonic(const struct fence_clock *fc, uint64_t ns)
+{
+	if (!ns)
+		return 0;
+
+	double since_ns = (double)(int64_t)(ns - fc->base_ns);
+	return ns + fc->offset_ns + (int64_t)(since_ns * fc->drift);
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include <EGL/egl.h>
+
+#include "timer.h"
+#include "util.h"
+
+/*
+ * GL_TIMESTAMP_EXT is the GPU's time once all previous commands have
+ * reached it. Bracketing it with CLOCK_MONOTONIC gets us within a fraction
+ * of the round trip.
+ */
+static void calibrate(struct gpu_timer *timer)
+{
+	GLint64 gpu_ns;
+	uint64_t before_ns = get_time_ns();
+
+	timer->get_integer64v(GL_TIMESTAMP_EXT, &gpu_ns);
+
+	uint64_t after_ns = get_time_ns();
+	timer->offset_ns = gpu_ns - (int64_t)(before_ns + (after_ns - before_ns) / 2);
+}
+
+bool gpu_timer_init(struct gpu_timer *timer)
+{
+	const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+
+	*timer = (struct gpu_timer){0};
+
+	if (!exts || !has_ext(exts, "GL_EXT_disjoint_timer_query"))
+		return false;
+
+	timer->gen_queries = (void *)eglGetProcAddress("glGenQueriesEXT");
+	timer->delete_queries = (void *)eglGetProcAddress("glDeleteQueriesEXT");
+	timer->begin_query = (void *)eglGetProcAddress("glBeginQueryEXT");
+	timer->end_query = (void *)eglGetProcAddress("glEndQueryEXT");
+	timer->query_counter = (void *)eglGetProcAddress("glQueryCounterEXT");
+	timer->get_query_iv = (void *)eglGetProcAddress("glGetQueryivEXT");
+	timer->get_query_object_uiv = (void *)eglGetProcAddress("glGetQueryObjectuivEXT");
+	timer->get_query_object_ui64v = (void *)eglGetProcAddress("glGetQueryObjectui64vEXT");
+	timer->get_integer64v = (void *)eglGetProcAddress("glGetInteger64vEXT");
+
+	for (int i = 0; i < GPU_TIMER_QUERIES; ++i) {
+		timer->gen_queries(1, &timer->queries[i].elapsed);
+		timer->gen_queries(1, &timer->queries[i].start);
+	}
+
+	/* Timestamps are optional, time elapsed queries aren't */
+	GLint bits = 0;
+	timer->get_query_iv(GL_TIMESTAMP_EXT, GL_QUERY_COUNTER_BITS_EXT, &bits);
+	timer->has_timestamp = bits > 0;
+
+	/* Reading it resets it, so don't let a stale one throw away our first results */
+	GLint disjoint;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+	if (timer->has_timestamp)
+		calibrate(timer);
+
+	return true;
+}
+
+void gpu_timer_finish(struct gpu_timer *timer)
+{
+	if (!timer->delete_queries)
+		return;
+
+	for (int i = 0; i < GPU_TIMER_QUERIES; ++i) {
+		timer->delete_queries(1, &timer->queries[i].elapsed);
+		timer->delete_queries(1, &timer->queries[i].start);
+	}
+}
+
+bool gpu_timer_begin(struct gpu_timer *timer, struct frame *frame)
+{
+	if (timer->head - timer->tail == GPU_TIMER_QUERIES)
+		return false;
+
+	struct gpu_query *query = &timer->queries[timer->head % GPU_TIMER_QUERIES];
+
+	query->frame = frame;
+	query->disjoint = false;
+
+	if (timer->has_timestamp)
+		timer->query_counter(query->start, GL_TIMESTAMP_EXT);
+	timer->begin_query(GL_TIME_ELAPSED_EXT, query->elapsed);
+
+	return true;
+}
+
+void gpu_timer_end(struct gpu_timer *timer)
+{
+	timer->end_query(GL_TIME_ELAPSED_EXT);
+	++timer->head;
+}
+
+struct frame *gpu_timer_poll(struct gpu_timer *timer)
+{
+	GLint disjoint = 0;
+
+	if (timer->head == timer->tail)
+		return NULL;
+
+	/*
+	 * A disjoint operation (e.g. a GPU reset or frequency change) makes the
+	 * results of every query in flight meaningless, and may have moved
+	 * the GPU's clock.
+	 */
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	if (disjoint) {
+		for (unsigned i = timer->tail; i != timer->head; ++i)
+			timer->queries[i % GPU_TIMER_QUERIES].disjoint = true;
+		if (timer->has_timestamp)
+			calibrate(timer);
+	}
+
+	/* Queries complete in order, and the elapsed one always ends last */
+	struct gpu_query *query = &timer->queries[timer->tail % GPU_TIMER_QUERIES];
+	GLuint available = GL_FALSE;
+
+	timer->get_query_object_uiv(query->elapsed, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+	if (!available)
+		return NULL;
+
+	++timer->tail;
+
+	struct frame *frame = query->frame;
+	if (query->disjoint)
+		return frame;
+
+	GLuint64 elapsed_ns;
+	timer->get_query_object_ui64v(query->elapsed, GL_QUERY_RESULT_EXT, &elapsed_ns);
+	frame->gpu_time_ns = elapsed_ns;
+
+	if (timer->has_timestamp) {
+		GLuint64 start_ns;
+		timer->get_query_object_ui64v(query->start, GL_QUERY_RESULT_EXT, &start_ns);
+		frame->gpu_start_ns = start_ns - timer->offset_ns;
+	}
+
+	return frame;
+}
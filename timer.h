@@ -0,0 +1,70 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "frames.h"
+
+/* Queries in flight, frames beyond that simply aren't timed */
+#define GPU_TIMER_QUERIES 64
+
+struct gpu_query {
+	GLuint elapsed;
+	/* GL_TIMESTAMP_EXT counter, only used if the GPU supports it */
+	GLuint start;
+	struct frame *frame;
+	/* Set if the results are undefined because of GL_GPU_DISJOINT_EXT */
+	bool disjoint;
+};
+
+/*
+ * GL_EXT_disjoint_timer_query based timing, for drivers without native
+ * fences. Queries are used in a ring and read back in order once they are
+ * available, so this never stalls the pipeline.
+ */
+struct gpu_timer {
+	struct gpu_query queries[GPU_TIMER_QUERIES];
+	/* In flight queries are [tail, head), modulo GPU_TIMER_QUERIES */
+	unsigned head;
+	unsigned tail;
+
+	bool has_timestamp;
+	/* GPU timestamp minus CLOCK_MONOTONIC */
+	int64_t offset_ns;
+
+	PFNGLGENQUERIESEXTPROC gen_queries;
+	PFNGLDELETEQUERIESEXTPROC delete_queries;
+	PFNGLBEGINQUERYEXTPROC begin_query;
+	PFNGLENDQUERYEXTPROC end_query;
+	PFNGLQUERYCOUNTEREXTPROC query_counter;
+	PFNGLGETQUERYIVEXTPROC get_query_iv;
+	PFNGLGETQUERYOBJECTUIVEXTPROC get_query_object_uiv;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_object_ui64v;
+	PFNGLGETINTEGER64VEXTPROC get_integer64v;
+};
+
+/* Needs a current context. Returns false if timer queries are unsupported. */
+bool gpu_timer_init(struct gpu_timer *timer);
+
+void gpu_timer_finish(struct gpu_timer *timer);
+
+/*
+ * Brackets the frame's draw calls. Returns false if every query is in
+ * flight, in which case the frame isn't timed and gpu_timer_end() mustn't
+ * be called.
+ */
+bool gpu_timer_begin(struct gpu_timer *timer, struct frame *frame);
+void gpu_timer_end(struct gpu_timer *timer);
+
+/*
+ * Returns the oldest timed frame whose results are in, with gpu_time_ns and
+ * gpu_start_ns filled in, or NULL if there is none. Both are left 0 if the
+ * results were lost to a disjoint operation.
+ */
+struct frame *gpu_timer_poll(struct gpu_timer *timer);
+
+#endif
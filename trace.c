@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_BUF_SIZE (1 << 20)
+/* More than any single record needs */
+#define TRACE_RECORD_MAX 512
+
+static const char csv_header[] =
+	"frame,surface,start_ns,end_ns,done_ns,done_time,gpu_start_ns,gpu_time_ns,"
+	"presented_ns,refresh_ns,present_flags,discarded,width,height,iter,aa,depth,"
+	"released_ns,release_fenced,phase,checksum\n";
+
+static void flush(struct trace *trace)
+{
+	size_t off = 0;
+
+	while (off < trace->len) {
+		ssize_t ret = write(trace->fd, trace->buf + off, trace->len - off);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			break;
+		}
+		off += ret;
+	}
+
+	trace->len = 0;
+}
+
+int trace_open(struct trace *trace, const char *path)
+{
+	size_t len = strlen(path);
+
+	trace->format = TRACE_JSON_LINES;
+	if (len >= 4 && strcmp(path + len - 4, ".csv") == 0)
+		trace->format = TRACE_CSV;
+
+	trace->len = 0;
+	trace->buf = malloc(TRACE_BUF_SIZE);
+	if (!trace->buf)
+		return -1;
+
+	if (strcmp(path, "-") == 0)
+		trace->fd = dup(STDOUT_FILENO);
+	else
+		trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (trace->fd == -1) {
+		perror(path);
+		free(trace->buf);
+		trace->buf = NULL;
+		return -1;
+	}
+
+	if (trace->format == TRACE_CSV) {
+		memcpy(trace->buf, csv_header, sizeof csv_header - 1);
+		trace->len = sizeof csv_header - 1;
+	}
+
+	return 0;
+}
+
+/* Unknown timestamps are 0, which become null or an empty CSV field */
+static int format_ns(char *buf, size_t size, uint64_t ns, enum trace_format format)
+{
+	if (ns)
+		return snprintf(buf, size, "%" PRIu64, ns);
+	return snprintf(buf, size, "%s", format == TRACE_CSV ? "" : "null");
+}
+
+void trace_frame(struct trace *trace, const struct frame *frame)
+{
+	char end[24];
+	char done[24];
+	char done_time[24];
+	char presented[24];
+	char gpu_start[24];
+	char gpu_time[24];
+	char released[24];
+	char checksum[24];
+
+	if (!trace->buf)
+		return;
+
+	if (TRACE_BUF_SIZE - trace->len < TRACE_RECORD_MAX)
+		flush(trace);
+
+	format_ns(end, sizeof end, frame->end_ns, trace->format);
+	format_ns(done, sizeof done, frame->done_ns, trace->format);
+	if (frame->done_ns)
+		snprintf(done_time, sizeof done_time, "%" PRIu32, frame->done_time);
+	else
+		format_ns(done_time, sizeof done_time, 0, trace->format);
+	format_ns(presented, sizeof presented, frame->presented_ns, trace->format);
+	format_ns(gpu_start, sizeof gpu_start, frame->gpu_start_ns, trace->format);
+	format_ns(gpu_time, sizeof gpu_time, frame->gpu_time_ns, trace->format);
+	format_ns(released, sizeof released, frame->released_ns, trace->format);
+	/* As a string, JSON numbers can't hold 64 bits */
+	if (frame->checksum && trace->format == TRACE_CSV)
+		snprintf(checksum, sizeof checksum, "%016" PRIx64, frame->checksum);
+	else if (frame->checksum)
+		snprintf(checksum, sizeof checksum, "\"%016" PRIx64 "\"", frame->checksum);
+	else
+		format_ns(checksum, sizeof checksum, 0, trace->format);
+
+	char *p = trace->buf + trace->len;
+	size_t size = TRACE_BUF_SIZE - trace->len;
+	int ret;
+
+	if (trace->format == TRACE_CSV) {
+		ret = snprintf(p, size, "%d,%d,%" PRIu64 ",%s,%s,%s,%s,%s,%s,%" PRIu32 ",%" PRIu32 ",%d,%d,%d,%d,%d,%" PRIu32 ",%s,%d,%d,%s\n",
+			frame->frame_num, frame->surface, frame->start_ns, end, done, done_time,
+			gpu_start, gpu_time, presented, frame->refresh_ns,
+			frame->present_flags, frame->discarded,
+			frame->width, frame->height, frame->iter, frame->aa,
+			frame->depth, released, frame->release_fenced, frame->phase,
+			checksum);
+	} else {
+		ret = snprintf(p, size,
+			"{\"frame\":%d,\"surface\":%d,\"start_ns\":%" PRIu64 ",\"end_ns\":%s,"
+			"\"done_ns\":%s,\"done_time\":%s,\"gpu_start_ns\":%s,"
+			"\"gpu_time_ns\":%s,\"presented_ns\":%s,"
+			"\"refresh_ns\":%" PRIu32 ",\"present_flags\":%" PRIu32 ","
+			"\"discarded\":%s,\"width\":%d,\"height\":%d,"
+			"\"iter\":%d,\"aa\":%d,\"depth\":%" PRIu32 ","
+			"\"released_ns\":%s,\"release_fenced\":%s,\"phase\":%d,"
+			"\"checksum\":%s}\n",
+			frame->frame_num, frame->surface, frame->start_ns, end, done,
+			done_time, gpu_start, gpu_time, presented, frame->refresh_ns,
+			frame->present_flags, frame->discarded ? "true" : "false",
+			frame->width, frame->height, frame->iter, frame->aa,
+			frame->depth, released, frame->release_fenced ? "true" : "false",
+			frame->phase, checksum);
+	}
+
+	if (ret > 0 && (size_t)ret < size)
+		trace->len += ret;
+}
+
+void trace_close(struct trace *trace)
+{
+	if (!trace->buf)
+		return;
+
+	flush(trace);
+	close(trace->fd);
+	free(trace->buf);
+	trace->buf = NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+
+#include "frames.h"
+
+enum trace_format {
+	TRACE_JSON_LINES,
+	TRACE_CSV,
+};
+
+/*
+ * One record per completed frame. Records are collected in a large buffer
+ * and written out with write(2) a block at a time, so tracing at high frame
+ * rates costs next to nothing.
+ */
+struct trace {
+	int fd;
+	enum trace_format format;
+	char *buf;
+	size_t len;
+};
+
+/* Files ending in .csv get CSV, anything else JSON Lines. "-" is stdout. */
+int trace_open(struct trace *trace, const char *path);
+
+void trace_frame(struct trace *trace, const struct frame *frame);
+
+/* Writes out anything buffered and closes the file */
+void trace_close(struct trace *trace);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec ts = {0};
+
+	/*
+	 * Fence timestamps are converted to this clock, see fence_clock.
+	 *
+	 * Sampling the clock from userspace might not be the most accurate way
+	 * to do this, but it's good enough for our purposes.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+/*
+ * For the presentation clock, which is almost always CLOCK_MONOTONIC but
+ * is the compositor's choice. Otherwise, go by the current offset.
+ */
+static inline uint64_t clock_to_monotonic(clockid_t clock, uint64_t ns)
+{
+	struct timespec ts = {0};
+
+	if (clock == CLOCK_MONOTONIC)
+		return ns;
+
+	clock_gettime(clock, &ts);
+	return ns - (ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec) + get_time_ns();
+}
+
+static inline bool has_ext(const char *exts, const char *ext)
+{
+	while (*exts) {
+		const char *end = strchr(exts, ' ');
+		size_t len = end ? (size_t)(end - exts) : strlen(exts);
+
+		if (strncmp(exts, ext, len) == 0)
+			return true;
+		exts += len + !!end;
+	}
+
+	return false;
+}
+
+#endif
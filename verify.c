@@ -0,0 +1,528 @@
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <GLES3/gl3.h>
+
+#include "cpu.h"
+#include "pool.h"
+#include "verify.h"
+
+struct verify_slot {
+	struct frame *frame;
+	struct camera_pose pose;
+	bool compare;
+	/* Without pixel buffer objects, set if it went to the reference thread */
+	bool deferred;
+
+	/* With pixel buffer objects, sync signals once pbo can be mapped */
+	GLuint pbo;
+	GLsizeiptr pbo_size;
+	GLsync sync;
+};
+
+/*
+ * The frame being compared on the reference thread. Owned by the render
+ * thread while frame is NULL or done is set, by the reference thread
+ * otherwise.
+ */
+struct verify_job {
+	struct frame *frame;
+	struct camera_pose pose;
+	bool done;
+
+	/* A copy of the readback, bottom row first */
+	uint8_t *pixels;
+	size_t pixels_size;
+};
+
+struct verify {
+	int every;
+	int tolerance;
+	bool checksum;
+	bool has_pbo;
+
+	struct verify_slot slots[VERIFY_SLOTS];
+	/* In flight readbacks are [tail, head), modulo VERIFY_SLOTS */
+	unsigned head;
+	unsigned tail;
+
+	/* Without pixel buffer objects, frames are read into this */
+	uint8_t *pixels;
+	size_t pixels_size;
+
+	/*
+	 * The CPU rendering takes as long as a frame at the same settings
+	 * does on the CPU, so it runs on a thread of its own, spread over the
+	 * pool. Only one frame is compared at a time.
+	 */
+	pthread_t thread;
+	bool has_thread;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	bool quit;
+	struct verify_job job;
+
+	/* Only touched by the reference thread */
+	struct pool *pool;
+	struct cpu_frame cpu_frame;
+	uint32_t *reference;
+	size_t reference_size;
+
+	/* Totals for verify_print() */
+	int readbacks;
+	int compared;
+	/* Frames due for comparison while another one still was */
+	int skipped;
+	int failed;
+	uint64_t mismatched;
+	double min_psnr;
+	double psnr_sum;
+	int psnr_frames;
+	int worst_frame;
+};
+
+static void *reference_main(void *data);
+
+struct verify *verify_create(int every, int tolerance, bool checksum)
+{
+	struct verify *verify = calloc(1, sizeof *verify);
+	if (!verify)
+		return NULL;
+
+	verify->every = every;
+	verify->tolerance = tolerance;
+	verify->checksum = checksum;
+	verify->min_psnr = INFINITY;
+	verify->worst_frame = -1;
+
+	pthread_mutex_init(&verify->lock, NULL);
+	pthread_cond_init(&verify->start, NULL);
+	pthread_cond_init(&verify->done, NULL);
+
+	/* Mapping buffers for reading is ES 3.0 only, even with GL_NV_pixel_buffer_object */
+	const char *version = (const char *)glGetString(GL_VERSION);
+	int major = 0;
+
+	if (version && sscanf(version, "OpenGL ES %d", &major) == 1 && major >= 3)
+		verify->has_pbo = true;
+
+	if (verify->has_pbo) {
+		for (int i = 0; i < VERIFY_SLOTS; ++i)
+			glGenBuffers(1, &verify->slots[i].pbo);
+	}
+
+	if (every > 0) {
+		cpu_init();
+
+		/* A single-threaded reference takes ages at any real size */
+		long threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (threads > 1)
+			verify->pool = pool_create(threads);
+
+		int ret = pthread_create(&verify->thread, NULL, reference_main, verify);
+		if (ret != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+			verify_destroy(verify);
+			return NULL;
+		}
+		verify->has_thread = true;
+	}
+
+	return verify;
+}
+
+void verify_destroy(struct verify *verify)
+{
+	if (!verify)
+		return;
+
+	if (verify->has_thread) {
+		pthread_mutex_lock(&verify->lock);
+		verify->quit = true;
+		pthread_cond_signal(&verify->start);
+		pthread_mutex_unlock(&verify->lock);
+
+		pthread_join(verify->thread, NULL);
+	}
+
+	for (unsigned i = verify->tail; i != verify->head; ++i) {
+		struct verify_slot *slot = &verify->slots[i % VERIFY_SLOTS];
+		if (slot->sync)
+			glDeleteSync(slot->sync);
+	}
+	if (verify->has_pbo) {
+		for (int i = 0; i < VERIFY_SLOTS; ++i)
+			glDeleteBuffers(1, &verify->slots[i].pbo);
+	}
+
+	pthread_cond_destroy(&verify->done);
+	pthread_cond_destroy(&verify->start);
+	pthread_mutex_destroy(&verify->lock);
+
+	pool_destroy(verify->pool);
+	free(verify->reference);
+	free(verify->job.pixels);
+	free(verify->pixels);
+	free(verify);
+}
+
+bool verify_wants(const struct verify *verify, int frame_num)
+{
+	return verify->checksum || (verify->every > 0 && frame_num % verify->every == 0);
+}
+
+/* FNV-1a over pixels as R | G << 8 | B << 16 | A << 24, top row first */
+#define FNV_OFFSET UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME UINT64_C(0x100000001b3)
+
+static uint64_t checksum_rgba(const uint8_t *data, int width, int height)
+{
+	uint64_t hash = FNV_OFFSET;
+
+	/* glReadPixels() starts at the bottom row */
+	for (int y = height - 1; y >= 0; --y) {
+		const uint8_t *p = data + (size_t)y * width * 4;
+
+		for (int x = 0; x < width; ++x, p += 4) {
+			hash ^= (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+				(uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+			hash *= FNV_PRIME;
+		}
+	}
+
+	return hash;
+}
+
+uint64_t verify_checksum_cpu(const uint32_t *data, int stride, int width, int height)
+{
+	uint64_t hash = FNV_OFFSET;
+
+	for (int y = 0; y < height; ++y) {
+		const uint32_t *row = data + (size_t)y * stride;
+
+		for (int x = 0; x < width; ++x) {
+			uint32_t p = row[x];
+
+			/* XRGB8888 is A << 24 | R << 16 | G << 8 | B */
+			hash ^= (p & 0xff00ff00) | (p >> 16 & 0xff) | (p & 0xff) << 16;
+			hash *= FNV_PRIME;
+		}
+	}
+
+	return hash;
+}
+
+static int channel_diff(uint32_t a, uint32_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+/*
+ * Renders the reference and compares the job's readback against it, RGB
+ * only. Runs on the reference thread, and only writes to the job's frame.
+ */
+static void compare(struct verify *verify)
+{
+	struct verify_job *job = &verify->job;
+	struct frame *frame = job->frame;
+	size_t size = (size_t)frame->width * frame->height * sizeof(uint32_t);
+
+	if (size > verify->reference_size) {
+		uint32_t *reference = realloc(verify->reference, size);
+		if (!reference)
+			return;
+		verify->reference = reference;
+		verify->reference_size = size;
+	}
+
+	cpu_frame_init(&verify->cpu_frame, &job->pose, frame->width, frame->height,
+		frame->iter, frame->aa);
+	if (verify->pool)
+		pool_render(verify->pool, &verify->cpu_frame, verify->reference,
+			frame->width, NULL);
+	else
+		cpu_render(&verify->cpu_frame, verify->reference, frame->width,
+			0, 0, frame->width, frame->height);
+
+	uint64_t sq_sum = 0;
+	uint32_t mismatched = 0;
+
+	for (int y = 0; y < frame->height; ++y) {
+		const uint8_t *p = job->pixels + (size_t)(frame->height - 1 - y) * frame->width * 4;
+		const uint32_t *row = verify->reference + (size_t)y * frame->width;
+
+		for (int x = 0; x < frame->width; ++x, p += 4) {
+			int dr = channel_diff(p[0], row[x] >> 16 & 0xff);
+			int dg = channel_diff(p[1], row[x] >> 8 & 0xff);
+			int db = channel_diff(p[2], row[x] & 0xff);
+
+			sq_sum += dr * dr + dg * dg + db * db;
+			if (dr > verify->tolerance || dg > verify->tolerance ||
+					db > verify->tolerance)
+				++mismatched;
+		}
+	}
+
+	/* Identical frames have an infinite PSNR */
+	double mse = (double)sq_sum / (3.0 * frame->width * frame->height);
+	frame->psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+	frame->mismatched = mismatched;
+	frame->verified = true;
+}
+
+static void *reference_main(void *data)
+{
+	struct verify *verify = data;
+
+	pthread_mutex_lock(&verify->lock);
+	for (;;) {
+		while (!verify->quit && (!verify->job.frame || verify->job.done))
+			pthread_cond_wait(&verify->start, &verify->lock);
+		if (verify->quit)
+			break;
+		pthread_mutex_unlock(&verify->lock);
+
+		compare(verify);
+
+		pthread_mutex_lock(&verify->lock);
+		verify->job.done = true;
+		pthread_cond_signal(&verify->done);
+	}
+	pthread_mutex_unlock(&verify->lock);
+
+	return NULL;
+}
+
+/*
+ * Returns the compared frame once the reference thread is done with it,
+ * waiting for that with block, or NULL if it isn't done or there is none.
+ */
+static struct frame *reference_done(struct verify *verify, bool block)
+{
+	struct verify_job *job = &verify->job;
+	struct frame *frame = NULL;
+
+	pthread_mutex_lock(&verify->lock);
+	while (block && job->frame && !job->done)
+		pthread_cond_wait(&verify->done, &verify->lock);
+	if (job->frame && job->done) {
+		frame = job->frame;
+		job->frame = NULL;
+		job->done = false;
+	}
+	pthread_mutex_unlock(&verify->lock);
+
+	if (!frame || !frame->verified)
+		return frame;
+
+	++verify->compared;
+	verify->mismatched += frame->mismatched;
+	if (frame->mismatched)
+		++verify->failed;
+	if (isfinite(frame->psnr)) {
+		verify->psnr_sum += frame->psnr;
+		++verify->psnr_frames;
+	}
+	if (frame->psnr < verify->min_psnr || verify->worst_frame < 0) {
+		verify->min_psnr = frame->psnr;
+		verify->worst_frame = frame->frame_num;
+	}
+
+	return frame;
+}
+
+/*
+ * Hands the readback to the reference thread if it is idle. Only the
+ * render thread starts jobs, so checking without the lock is fine.
+ */
+static bool start_job(struct verify *verify, struct verify_slot *slot, const uint8_t *data)
+{
+	struct verify_job *job = &verify->job;
+	struct frame *frame = slot->frame;
+	size_t size = (size_t)frame->width * frame->height * 4;
+
+	if (job->frame) {
+		++verify->skipped;
+		return false;
+	}
+
+	if (size > job->pixels_size) {
+		uint8_t *pixels = realloc(job->pixels, size);
+		if (!pixels)
+			return false;
+		job->pixels = pixels;
+		job->pixels_size = size;
+	}
+	memcpy(job->pixels, data, size);
+
+	pthread_mutex_lock(&verify->lock);
+	job->frame = frame;
+	job->pose = slot->pose;
+	job->done = false;
+	pthread_cond_signal(&verify->start);
+	pthread_mutex_unlock(&verify->lock);
+
+	return true;
+}
+
+/* Returns true if the frame went to the reference thread */
+static bool process(struct verify *verify, struct verify_slot *slot, const uint8_t *data)
+{
+	struct frame *frame = slot->frame;
+
+	++verify->readbacks;
+
+	if (verify->checksum)
+		frame->checksum = checksum_rgba(data, frame->width, frame->height);
+
+	return slot->compare && start_job(verify, slot, data);
+}
+
+/* Without pixel buffer objects, the whole readback happens here */
+static void read_sync(struct verify *verify, struct verify_slot *slot)
+{
+	struct frame *frame = slot->frame;
+	size_t size = (size_t)frame->width * frame->height * 4;
+
+	slot->deferred = false;
+
+	if (size > verify->pixels_size) {
+		uint8_t *pixels = realloc(verify->pixels, size);
+		if (!pixels)
+			return;
+		verify->pixels = pixels;
+		verify->pixels_size = size;
+	}
+
+	glReadPixels(0, 0, frame->width, frame->height, GL_RGBA, GL_UNSIGNED_BYTE,
+		verify->pixels);
+	slot->deferred = process(verify, slot, verify->pixels);
+}
+
+bool verify_read(struct verify *verify, struct frame *frame,
+		const struct camera_pose *pose)
+{
+	if (verify->head - verify->tail == VERIFY_SLOTS)
+		return false;
+
+	struct verify_slot *slot = &verify->slots[verify->head % VERIFY_SLOTS];
+	GLsizeiptr size = (GLsizeiptr)frame->width * frame->height * 4;
+
+	slot->frame = frame;
+	slot->pose = *pose;
+	/* Past CPU_MAX_AA there is no reference to compare against */
+	slot->compare = verify->every > 0 && frame->frame_num % verify->every == 0 &&
+		frame->aa <= CPU_MAX_AA;
+
+	if (verify->has_pbo) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+		if (slot->pbo_size != size) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+			slot->pbo_size = size;
+		}
+		glReadPixels(0, 0, frame->width, frame->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		slot->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	} else {
+		/* Has to happen before the next frame draws over it */
+		read_sync(verify, slot);
+	}
+
+	++verify->head;
+	return true;
+}
+
+/*
+ * Finishes the oldest readback, if it's done or wait is set. Returns false
+ * if it isn't done yet. *frame is left NULL if it went on to the reference
+ * thread.
+ */
+static bool finish_readback(struct verify *verify, bool wait, struct frame **frame)
+{
+	struct verify_slot *slot = &verify->slots[verify->tail % VERIFY_SLOTS];
+
+	*frame = slot->frame;
+
+	/* Already read back in verify_read() */
+	if (!verify->has_pbo) {
+		++verify->tail;
+		if (slot->deferred)
+			*frame = NULL;
+		return true;
+	}
+
+	/* Readbacks complete in order, like everything else on the GPU */
+	GLbitfield flags = wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0;
+	GLenum status;
+
+	do {
+		status = glClientWaitSync(slot->sync, flags, wait ? 100000000 : 0);
+	} while (wait && status == GL_TIMEOUT_EXPIRED);
+
+	if (status == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	glDeleteSync(slot->sync);
+	slot->sync = NULL;
+	++verify->tail;
+
+	/* GL_WAIT_FAILED, the frame just goes without */
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return true;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	const uint8_t *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot->pbo_size,
+		GL_MAP_READ_BIT);
+	if (data) {
+		if (process(verify, slot, data))
+			*frame = NULL;
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	return true;
+}
+
+struct frame *verify_poll(struct verify *verify, bool wait)
+{
+	for (;;) {
+		struct frame *frame = reference_done(verify, false);
+		if (frame)
+			return frame;
+
+		/* Only the comparison is left to wait for */
+		if (verify->head == verify->tail)
+			return wait ? reference_done(verify, true) : NULL;
+
+		if (!finish_readback(verify, wait, &frame))
+			return NULL;
+		if (frame)
+			return frame;
+	}
+}
+
+void verify_print(const struct verify *verify, FILE *f)
+{
+	fprintf(f, "Readback: %d frames, %s\n", verify->readbacks,
+		verify->has_pbo ? "asynchronous" : "synchronous");
+
+	if (verify->every == 0)
+		return;
+
+	if (verify->compared == 0) {
+		fprintf(f, "Verify: no frames compared, %d skipped\n", verify->skipped);
+		return;
+	}
+
+	fprintf(f, "Verify: %d frames, %d skipped, %d with mismatches, %" PRIu64 " mismatched pixels, "
+		"PSNR mean %.2f dB, min %.2f dB (frame %d)\n",
+		verify->compared, verify->skipped, verify->failed, verify->mismatched,
+		verify->psnr_frames ? verify->psnr_sum / verify->psnr_frames : INFINITY,
+		verify->min_psnr, verify->worst_frame);
+}
@@ -0,0 +1,55 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "camera.h"
+#include "frames.h"
+
+/* Readbacks in flight, any more wait for the oldest one */
+#define VERIFY_SLOTS 8
+
+/* Per channel difference still counted as a match, out of 255 */
+#define VERIFY_DEFAULT_TOLERANCE 2
+
+struct verify;
+
+/*
+ * Reads frames back from the GPU to checksum every one of them, and/or
+ * compare every nth one against cpu_render(), if every isn't 0. Needs a
+ * current context. With OpenGL ES 3.0, readbacks go through pixel buffer
+ * objects and are picked up once done, so they don't stall the pipeline.
+ * Otherwise glReadPixels() blocks until the frame is rendered. The CPU
+ * rendering happens on a thread of its own, one frame at a time; frames
+ * due for comparison while it is busy are skipped.
+ */
+struct verify *verify_create(int every, int tolerance, bool checksum);
+
+void verify_destroy(struct verify *verify);
+
+/* Whether the frame has to be read back at all */
+bool verify_wants(const struct verify *verify, int frame_num);
+
+/*
+ * Starts reading back the bound framebuffer, after frame was drawn into it
+ * with pose. Returns false if every slot is in flight, in which case
+ * verify_poll() has to give one back first.
+ */
+bool verify_read(struct verify *verify, struct frame *frame,
+	const struct camera_pose *pose);
+
+/*
+ * Returns a frame whose readback, and comparison if any, is done, with
+ * the results filled in, or NULL if there is none. With wait, blocks until
+ * there is one, and only returns NULL once nothing is left in flight.
+ */
+struct frame *verify_poll(struct verify *verify, bool wait);
+
+/* The same checksum as for a readback, of an XRGB8888 buffer from cpu_render() */
+uint64_t verify_checksum_cpu(const uint32_t *data, int stride, int width, int height);
+
+void verify_print(const struct verify *verify, FILE *f);
+
+#endif
@@ -0,0 +1,224 @@
+#include <inttypes.h>
+#include <math.h>
+
+#include "util.h"
+#include "victim.h"
+
+static const uint32_t colors[VICTIM_BUFFERS] = {
+	0xff3050c0,
+	0xffc05030,
+};
+
+static void victim_draw(struct victim *victim);
+
+static void feedback_sync_output(void *data, struct wp_presentation_feedback *feedback,
+		struct wl_output *output)
+{
+	/* Don't care */
+}
+
+static void feedback_presented(void *data, struct wp_presentation_feedback *feedback,
+		uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh,
+		uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+{
+	struct victim_feedback *fb = data;
+	struct victim *victim = fb->victim;
+	uint64_t presented_ns = ((uint64_t)tv_sec_hi << 32 | tv_sec_lo) * 1000000000 + tv_nsec;
+
+	presented_ns = clock_to_monotonic(victim->presentation_clock, presented_ns);
+	pthread_mutex_lock(&victim->lock);
+	++victim->presented;
+	hist_record(&victim->present_latency, presented_ns - fb->commit_ns);
+	if (refresh)
+		victim->refresh_ns = refresh;
+	pthread_mutex_unlock(&victim->lock);
+
+	wp_presentation_feedback_destroy(fb->feedback);
+	fb->feedback = NULL;
+}
+
+static void feedback_discarded(void *data, struct wp_presentation_feedback *feedback)
+{
+	struct victim_feedback *fb = data;
+
+	pthread_mutex_lock(&fb->victim->lock);
+	++fb->victim->discarded;
+	pthread_mutex_unlock(&fb->victim->lock);
+
+	wp_presentation_feedback_destroy(fb->feedback);
+	fb->feedback = NULL;
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	.sync_output = feedback_sync_output,
+	.presented = feedback_presented,
+	.discarded = feedback_discarded,
+};
+
+static void frame_done(void *data, struct wl_callback *cb, uint32_t time)
+{
+	struct victim *victim = data;
+	uint64_t now_ns = get_time_ns();
+
+	wl_callback_destroy(victim->callback);
+	victim->callback = NULL;
+
+	pthread_mutex_lock(&victim->lock);
+	if (victim->last_done_ns) {
+		uint64_t interval_ns = now_ns - victim->last_done_ns;
+		long cycles = lround((double)interval_ns / victim->refresh_ns);
+
+		hist_record(&victim->interval, interval_ns);
+		if (cycles > 1)
+			victim->missed += cycles - 1;
+	}
+	victim->last_done_ns = now_ns;
+	++victim->frames;
+	pthread_mutex_unlock(&victim->lock);
+
+	victim_draw(victim);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_done,
+};
+
+static void victim_draw(struct victim *victim)
+{
+	struct shm_buffer *buf = victim->buffers[victim->next_buffer];
+
+	/* The colours never change, so a busy buffer can go again as it is */
+	victim->next_buffer = (victim->next_buffer + 1) % VICTIM_BUFFERS;
+
+	victim->callback = wl_surface_frame(victim->wl_surface);
+	wl_callback_add_listener(victim->callback, &frame_listener, victim);
+
+	for (int i = 0; victim->presentation && i < VICTIM_FEEDBACKS; ++i) {
+		struct victim_feedback *fb = &victim->feedbacks[i];
+		if (fb->feedback)
+			continue;
+
+		fb->feedback = wp_presentation_feedback(victim->presentation, victim->wl_surface);
+		wp_presentation_feedback_add_listener(fb->feedback, &feedback_listener, fb);
+		fb->commit_ns = get_time_ns();
+		break;
+	}
+
+	wl_surface_attach(victim->wl_surface, buf->wl_buffer, 0, 0);
+	wl_surface_damage(victim->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+	wl_surface_commit(victim->wl_surface);
+	buf->busy = true;
+}
+
+static void xdg_base_configure(void *data, struct xdg_surface *surf, uint32_t serial)
+{
+	struct victim *victim = data;
+
+	xdg_surface_ack_configure(surf, serial);
+
+	/* Only the first configure starts the frame callback loop */
+	if (!victim->callback && !victim->frames)
+		victim_draw(victim);
+}
+
+static const struct xdg_surface_listener xdg_base_listener = {
+	.configure = xdg_base_configure,
+};
+
+static void toplevel_configure(void *data, struct xdg_toplevel *top,
+		int32_t width, int32_t height, struct wl_array *states)
+{
+	/* Fixed size */
+}
+
+static void toplevel_close(void *data, struct xdg_toplevel *top)
+{
+	/* Only the main window can end the run */
+}
+
+static const struct xdg_toplevel_listener toplevel_listener = {
+	.configure = toplevel_configure,
+	.close = toplevel_close,
+};
+
+int victim_init(struct victim *victim, struct wl_compositor *compositor,
+		struct xdg_wm_base *wm_base, struct wl_shm *shm,
+		struct wp_presentation *presentation, clockid_t presentation_clock)
+{
+	*victim = (struct victim){
+		.presentation = presentation,
+		.presentation_clock = presentation_clock,
+		.refresh_ns = VICTIM_DEFAULT_REFRESH_NS,
+	};
+	pthread_mutex_init(&victim->lock, NULL);
+	hist_init(&victim->interval);
+	hist_init(&victim->present_latency);
+
+	for (int i = 0; i < VICTIM_BUFFERS; ++i) {
+		struct shm_buffer *buf = shm_buffer_create(shm, VICTIM_SIZE, VICTIM_SIZE);
+		if (!buf) {
+			victim_finish(victim);
+			return -1;
+		}
+
+		for (size_t j = 0; j < (size_t)VICTIM_SIZE * VICTIM_SIZE; ++j)
+			buf->data[j] = colors[i];
+		victim->buffers[i] = buf;
+	}
+
+	for (int i = 0; i < VICTIM_FEEDBACKS; ++i)
+		victim->feedbacks[i].victim = victim;
+
+	victim->wl_surface = wl_compositor_create_surface(compositor);
+	victim->xdg_surface = xdg_wm_base_get_xdg_surface(wm_base, victim->wl_surface);
+	victim->xdg_toplevel = xdg_surface_get_toplevel(victim->xdg_surface);
+
+	xdg_surface_add_listener(victim->xdg_surface, &xdg_base_listener, victim);
+	xdg_toplevel_add_listener(victim->xdg_toplevel, &toplevel_listener, victim);
+
+	xdg_toplevel_set_title(victim->xdg_toplevel, "compositor-killer victim");
+	xdg_toplevel_set_max_size(victim->xdg_toplevel, VICTIM_SIZE, VICTIM_SIZE);
+	xdg_toplevel_set_min_size(victim->xdg_toplevel, VICTIM_SIZE, VICTIM_SIZE);
+
+	wl_surface_commit(victim->wl_surface);
+
+	return 0;
+}
+
+void victim_finish(struct victim *victim)
+{
+	for (int i = 0; i < VICTIM_FEEDBACKS; ++i) {
+		if (victim->feedbacks[i].feedback)
+			wp_presentation_feedback_destroy(victim->feedbacks[i].feedback);
+	}
+
+	if (victim->callback)
+		wl_callback_destroy(victim->callback);
+
+	if (victim->xdg_toplevel)
+		xdg_toplevel_destroy(victim->xdg_toplevel);
+	if (victim->xdg_surface)
+		xdg_surface_destroy(victim->xdg_surface);
+	if (victim->wl_surface)
+		wl_surface_destroy(victim->wl_surface);
+
+	for (int i = 0; i < VICTIM_BUFFERS; ++i)
+		shm_buffer_destroy(victim->buffers[i]);
+
+	pthread_mutex_destroy(&victim->lock);
+}
+
+void victim_print(struct victim *victim, FILE *f)
+{
+	pthread_mutex_lock(&victim->lock);
+	fprintf(f, "Victim: %" PRIu64 " frames, %" PRIu64 " missed at %.3f ms refresh\n",
+		victim->frames, victim->missed, (double)victim->refresh_ns * 1e-6);
+	hist_print(&victim->interval, "Victim frame interval", f);
+
+	if (victim->presented || victim->discarded) {
+		fprintf(f, "Victim presentation: %" PRIu64 " presented, %" PRIu64 " discarded\n",
+			victim->presented, victim->discarded);
+		hist_print(&victim->present_latency, "Victim present latency", f);
+	}
+	pthread_mutex_unlock(&victim->lock);
+}
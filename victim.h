@@ -0,0 +1,74 @@
+#ifndef VICTIM_H
+#define VICTIM_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <wayland-client.h>
+
+#include "hist.h"
+#include "presentation-time-protocol.h"
+#include "shm.h"
+#include "xdg-shell-protocol.h"
+
+#define VICTIM_SIZE 256
+#define VICTIM_BUFFERS 2
+/* Presentation feedback in flight, further commits go without */
+#define VICTIM_FEEDBACKS 8
+/* Until presentation feedback tells us otherwise */
+#define VICTIM_DEFAULT_REFRESH_NS 16666667
+
+struct victim_feedback {
+	struct victim *victim;
+	struct wp_presentation_feedback *feedback;
+	uint64_t commit_ns;
+};
+
+/*
+ * A second, innocent toplevel which flips between two solid colours on
+ * every frame callback, the way a well behaved client would. Its frame
+ * callback intervals and presentation latency show how much the heavy
+ * surface drags everything else down with it.
+ */
+struct victim {
+	struct wl_surface *wl_surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	struct shm_buffer *buffers[VICTIM_BUFFERS];
+	struct wl_callback *callback;
+	int next_buffer;
+
+	struct wp_presentation *presentation;
+	clockid_t presentation_clock;
+	struct victim_feedback feedbacks[VICTIM_FEEDBACKS];
+
+	uint64_t last_done_ns;
+	uint64_t refresh_ns;
+
+	/*
+	 * Listeners run on the I/O thread with -T, while the summary is
+	 * printed on the render thread, so everything below is under lock.
+	 */
+	pthread_mutex_t lock;
+	uint64_t frames;
+	/* Refresh cycles which went by without a frame callback */
+	uint64_t missed;
+	uint64_t presented;
+	uint64_t discarded;
+	struct hist interval;
+	struct hist present_latency;
+};
+
+/* presentation may be NULL. Starts drawing once configured. */
+int victim_init(struct victim *victim, struct wl_compositor *compositor,
+	struct xdg_wm_base *wm_base, struct wl_shm *shm,
+	struct wp_presentation *presentation, clockid_t presentation_clock);
+
+void victim_finish(struct victim *victim);
+
+void victim_print(struct victim *victim, FILE *f);
+
+#endif